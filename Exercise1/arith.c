@@ -0,0 +1,568 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "command.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "arith.h"
+#include "trace.h"
+
+/*
+ * Scalar and broadcast ops, row and column reductions and the matrix sum.
+ * Every kernel makes one pass over the data, split into row bands across
+ * the worker pool. Each row is processed 4 elements at a time with SSE2
+ * when it is available. Column reductions never walk a column. Every band
+ * folds its rows into a private row of partial results, and the partial
+ * rows are merged at the end.
+ */
+
+typedef struct {
+	Matrix_t* m;
+	Arith_Op_t op;
+	unsigned int value;			/* scalar operand */
+	const unsigned int* row_vector;		/* operand row when broadcasting a row vector */
+	const unsigned int* col_vector;		/* operand per row when broadcasting a column vector */
+	unsigned int col_stride;
+}Arith_Args_t;
+
+typedef struct {
+	const Matrix_t* m;
+	Reduce_Op_t op;
+	Matrix_t* dest;
+	pthread_mutex_t lock;			/* guards the merge of column partials into dest */
+	bool failed;
+	unsigned long long sum;
+}Reduce_Args_t;
+
+/*protected functions*/
+static unsigned int arith_element (unsigned int a, unsigned int b, Arith_Op_t op);
+static unsigned int reduce_element (unsigned int a, unsigned int b, Reduce_Op_t op);
+static unsigned int reduce_identity (Reduce_Op_t op);
+static void arith_row (unsigned int* row, const unsigned int* vector, unsigned int value,
+			unsigned int cols, Arith_Op_t op);
+static void combine_row (unsigned int* acc, const unsigned int* row, unsigned int cols, Reduce_Op_t op);
+static unsigned int reduce_row (const unsigned int* row, unsigned int cols, Reduce_Op_t op);
+static void arith_band (void* arg, unsigned int row_begin, unsigned int row_end);
+static void reduce_rows_band (void* arg, unsigned int row_begin, unsigned int row_end);
+static void reduce_cols_band (void* arg, unsigned int row_begin, unsigned int row_end);
+static void sum_band (void* arg, unsigned int row_begin, unsigned int row_end);
+static bool same_data (const Matrix_t* a, const Matrix_t* b);
+
+#ifdef __SSE2__
+static inline __m128i mullo_epi32 (__m128i a, __m128i b);
+static inline __m128i min_epu32 (__m128i a, __m128i b);
+static inline __m128i max_epu32 (__m128i a, __m128i b);
+#endif
+
+/*
+	PURPOSE: Reads the name of an element op
+	INPUT: word - add, mul, and, or or xor
+		op - set to the op
+	RETURN: If word names an op returns true
+		else false
+*/
+bool parse_arith_op (const char* word, Arith_Op_t* op) {
+	static const char* names[] = { "add", "mul", "and", "or", "xor" };
+
+	for (unsigned int i = 0; word && i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (strcmp(word, names[i]) == 0) {
+			*op = (Arith_Op_t) i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+	PURPOSE: Reads the name of a reduction
+	INPUT: word - sum, min or max
+		op - set to the reduction
+	RETURN: If word names a reduction returns true
+		else false
+*/
+bool parse_reduce_op (const char* word, Reduce_Op_t* op) {
+	static const char* names[] = { "sum", "min", "max" };
+
+	for (unsigned int i = 0; word && i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (strcmp(word, names[i]) == 0) {
+			*op = (Reduce_Op_t) i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+	PURPOSE: Applies an op with a scalar to every element, in place
+	INPUT: m - the matrix
+		op - the element op
+		value - the scalar
+	RETURN: If successful returns true
+		else false
+*/
+bool scalar_matrix (Matrix_t* m, Arith_Op_t op, unsigned int value) {
+
+	if (!m || !m->data)
+	{
+		printf("No matrix and/or data!\n");
+		return false;
+	}
+
+	Arith_Args_t args = { m, op, value, NULL, NULL, 0 };
+	trace_begin("scalar", m->name, m->rows, m->cols);
+	parallel_for_rows("scalar:band", m->name, m->rows, m->cols, PARALLEL_MIN_BAND_ROWS, arith_band, &args);
+	mark_matrix_dirty(m, 0, m->rows);
+	trace_end("scalar", m->name);
+	return true;
+}
+
+/*
+	PURPOSE: Applies an op between every row and a 1 x cols vector, or
+		between every column and a rows x 1 vector, in place
+	INPUT: m - the matrix
+		op - the element op
+		vector - the row or column vector
+	RETURN: If successful returns true
+		else false
+*/
+bool broadcast_matrix (Matrix_t* m, Arith_Op_t op, Matrix_t* vector) {
+
+	if (!m || !m->data || !vector || !vector->data)
+	{
+		printf("One or more matrices are null or don't have any data!\n");
+		return false;
+	}
+	const bool row = vector->rows == 1 && vector->cols == m->cols;
+	const bool col = vector->cols == 1 && vector->rows == m->rows;
+	if (!row && !col)
+	{
+		printf("Vector must be 1 x %u or %u x 1!\n", m->cols, m->rows);
+		return false;
+	}
+
+	/* a vector sharing m's data would change under the bands */
+	unsigned int* copy = NULL;
+	const unsigned int* values = vector->data;
+	const unsigned int length = row ? vector->cols : vector->rows;
+	const unsigned int step = row ? 1 : vector->stride;
+	if (same_data(m, vector)) {
+		copy = malloc(length * sizeof(unsigned int));
+		if (!copy) {
+			return false;
+		}
+		for (unsigned int i = 0; i < length; ++i) {
+			copy[i] = vector->data[(size_t) i * step];
+		}
+		values = copy;
+	}
+
+	Arith_Args_t args = { m, op, 0, row ? values : NULL, row ? NULL : values, copy ? 1 : step };
+	trace_begin("broadcast", m->name, m->rows, m->cols);
+	parallel_for_rows("broadcast:band", m->name, m->rows, m->cols, PARALLEL_MIN_BAND_ROWS, arith_band, &args);
+	mark_matrix_dirty(m, 0, m->rows);
+	trace_end("broadcast", m->name);
+	free(copy);
+	return true;
+}
+
+/*
+	PURPOSE: Reduces every row to one value
+	INPUT: m - the matrix
+		op - the reduction
+		dest - rows x 1 matrix the results go to
+	RETURN: If successful returns true
+		else false
+*/
+bool reduce_matrix_rows (Matrix_t* m, Reduce_Op_t op, Matrix_t* dest) {
+
+	if (!m || !m->data || !dest || !dest->data)
+	{
+		printf("One or more matrices are null or don't have any data!\n");
+		return false;
+	}
+	if (dest->rows != m->rows || dest->cols != 1 || same_data(m, dest))
+	{
+		printf("Destination must be a separate %u x 1 matrix!\n", m->rows);
+		return false;
+	}
+
+	Reduce_Args_t args = { m, op, dest, PTHREAD_MUTEX_INITIALIZER, false, 0 };
+	trace_begin("reduce", m->name, m->rows, m->cols);
+	parallel_for_rows("reduce:band", m->name, m->rows, m->cols, PARALLEL_MIN_BAND_ROWS, reduce_rows_band, &args);
+	mark_matrix_dirty(dest, 0, dest->rows);
+	trace_end("reduce", m->name);
+	return true;
+}
+
+/*
+	PURPOSE: Reduces every column to one value
+	INPUT: m - the matrix
+		op - the reduction
+		dest - 1 x cols matrix the results go to
+	RETURN: If successful returns true
+		else false
+*/
+bool reduce_matrix_cols (Matrix_t* m, Reduce_Op_t op, Matrix_t* dest) {
+
+	if (!m || !m->data || !dest || !dest->data)
+	{
+		printf("One or more matrices are null or don't have any data!\n");
+		return false;
+	}
+	if (dest->rows != 1 || dest->cols != m->cols || same_data(m, dest))
+	{
+		printf("Destination must be a separate 1 x %u matrix!\n", m->cols);
+		return false;
+	}
+
+	Reduce_Args_t args = { m, op, dest, PTHREAD_MUTEX_INITIALIZER, false, 0 };
+	const unsigned int identity = reduce_identity(op);
+	for (unsigned int j = 0; j < dest->cols; ++j) {
+		dest->data[j] = identity;
+	}
+	trace_begin("reduce", m->name, m->rows, m->cols);
+	parallel_for_rows("reduce:band", m->name, m->rows, m->cols, PARALLEL_MIN_BAND_ROWS, reduce_cols_band, &args);
+	mark_matrix_dirty(dest, 0, dest->rows);
+	trace_end("reduce", m->name);
+	if (args.failed) {
+		printf("Out of memory for column partials!\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Adds up every element without wrapping at 32 bits
+	INPUT: m - the matrix
+		sum - set to the sum
+	RETURN: If successful returns true
+		else false
+*/
+bool sum_matrix (Matrix_t* m, unsigned long long* sum) {
+
+	if (!m || !m->data || !sum)
+	{
+		printf("No matrix and/or data!\n");
+		return false;
+	}
+
+	Reduce_Args_t args = { m, REDUCE_SUM, NULL, PTHREAD_MUTEX_INITIALIZER, false, 0 };
+	trace_begin("sum", m->name, m->rows, m->cols);
+	parallel_for_rows("sum:band", m->name, m->rows, m->cols, PARALLEL_MIN_BAND_ROWS, sum_band, &args);
+	trace_end("sum", m->name);
+	*sum = args.sum;
+	return true;
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: One element op
+	INPUT: a, b - operands
+		op - the op
+	RETURN: a op b
+*/
+static unsigned int arith_element (unsigned int a, unsigned int b, Arith_Op_t op) {
+	switch (op) {
+	case ARITH_ADD:
+		return a + b;
+	case ARITH_MUL:
+		return a * b;
+	case ARITH_AND:
+		return a & b;
+	case ARITH_OR:
+		return a | b;
+	default:
+		return a ^ b;
+	}
+}
+
+/*
+	PURPOSE: One step of a reduction
+	INPUT: a, b - operands
+		op - the reduction
+	RETURN: a and b combined
+*/
+static unsigned int reduce_element (unsigned int a, unsigned int b, Reduce_Op_t op) {
+	switch (op) {
+	case REDUCE_SUM:
+		return a + b;
+	case REDUCE_MIN:
+		return a < b ? a : b;
+	default:
+		return a > b ? a : b;
+	}
+}
+
+/*
+	PURPOSE: Starting value of a reduction
+	INPUT: op - the reduction
+	RETURN: The value that leaves any element unchanged
+*/
+static unsigned int reduce_identity (Reduce_Op_t op) {
+	return op == REDUCE_MIN ? 0xFFFFFFFFU : 0;
+}
+
+#ifdef __SSE2__
+/* expands to the SSE2 loop over the 4-element groups of a row */
+#define ROW_SSE2_LOOP(VEC_OP, DEST, A, B) \
+	for (; j + 4 <= cols; j += 4) { \
+		const __m128i a = A; \
+		const __m128i b = B; \
+		_mm_storeu_si128((__m128i*) &DEST[j], VEC_OP(a, b)); \
+	}
+#endif
+
+/*
+	PURPOSE: row[j] = row[j] op operand, where the operand is vector[j] or
+		value when vector is NULL
+	INPUT: row - the row
+		vector - per element operands, or NULL
+		value - operand for every element when vector is NULL
+		cols - elements in the row
+		op - the element op
+	RETURN: Nothing
+*/
+static void arith_row (unsigned int* row, const unsigned int* vector, unsigned int value,
+			unsigned int cols, Arith_Op_t op) {
+	unsigned int j = 0;
+#ifdef __SSE2__
+	const __m128i splat = _mm_set1_epi32(value);
+#define ARITH_ROW_SSE2(VEC_OP) ROW_SSE2_LOOP(VEC_OP, row, _mm_loadu_si128((const __m128i*) &row[j]), \
+			vector ? _mm_loadu_si128((const __m128i*) &vector[j]) : splat)
+	switch (op) {
+	case ARITH_ADD:
+		ARITH_ROW_SSE2(_mm_add_epi32);
+		break;
+	case ARITH_MUL:
+		ARITH_ROW_SSE2(mullo_epi32);
+		break;
+	case ARITH_AND:
+		ARITH_ROW_SSE2(_mm_and_si128);
+		break;
+	case ARITH_OR:
+		ARITH_ROW_SSE2(_mm_or_si128);
+		break;
+	case ARITH_XOR:
+		ARITH_ROW_SSE2(_mm_xor_si128);
+		break;
+	}
+#undef ARITH_ROW_SSE2
+#endif
+	for (; j < cols; ++j) {
+		row[j] = arith_element(row[j], vector ? vector[j] : value, op);
+	}
+}
+
+/*
+	PURPOSE: acc[j] = acc[j] combined with row[j]
+	INPUT: acc - the partial results
+		row - the row folded in
+		cols - elements in the row
+		op - the reduction
+	RETURN: Nothing
+*/
+static void combine_row (unsigned int* acc, const unsigned int* row, unsigned int cols, Reduce_Op_t op) {
+	unsigned int j = 0;
+#ifdef __SSE2__
+#define COMBINE_ROW_SSE2(VEC_OP) ROW_SSE2_LOOP(VEC_OP, acc, _mm_loadu_si128((const __m128i*) &acc[j]), \
+			_mm_loadu_si128((const __m128i*) &row[j]))
+	switch (op) {
+	case REDUCE_SUM:
+		COMBINE_ROW_SSE2(_mm_add_epi32);
+		break;
+	case REDUCE_MIN:
+		COMBINE_ROW_SSE2(min_epu32);
+		break;
+	case REDUCE_MAX:
+		COMBINE_ROW_SSE2(max_epu32);
+		break;
+	}
+#undef COMBINE_ROW_SSE2
+#endif
+	for (; j < cols; ++j) {
+		acc[j] = reduce_element(acc[j], row[j], op);
+	}
+}
+
+/*
+	PURPOSE: Reduces one row to a value
+	INPUT: row - the row
+		cols - elements in the row
+		op - the reduction
+	RETURN: The reduced row
+*/
+static unsigned int reduce_row (const unsigned int* row, unsigned int cols, Reduce_Op_t op) {
+	unsigned int result = reduce_identity(op);
+	unsigned int j = 0;
+#ifdef __SSE2__
+	if (cols >= 8) {
+		unsigned int lanes[4];
+		_mm_storeu_si128((__m128i*) lanes, _mm_set1_epi32(result));
+		combine_row(lanes, row, 4, op);
+		/* fold the row into 4 lanes, then the lanes into one value */
+		__m128i acc = _mm_loadu_si128((const __m128i*) lanes);
+		for (j = 4; j + 4 <= cols; j += 4) {
+			const __m128i v = _mm_loadu_si128((const __m128i*) &row[j]);
+			acc = op == REDUCE_SUM ? _mm_add_epi32(acc, v) : op == REDUCE_MIN ? min_epu32(acc, v) : max_epu32(acc, v);
+		}
+		_mm_storeu_si128((__m128i*) lanes, acc);
+		for (unsigned int k = 0; k < 4; ++k) {
+			result = reduce_element(result, lanes[k], op);
+		}
+	}
+#endif
+	for (; j < cols; ++j) {
+		result = reduce_element(result, row[j], op);
+	}
+	return result;
+}
+
+/*
+	PURPOSE: Runs a scalar or broadcast op over a band of rows
+	INPUT: arg - the Arith_Args_t
+		row_begin, row_end - rows of the band
+	RETURN: Nothing
+*/
+static void arith_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	const Arith_Args_t* a = arg;
+	Matrix_t* m = a->m;
+
+	for (unsigned int i = row_begin; i < row_end; ++i) {
+		const unsigned int value = a->col_vector ? a->col_vector[(size_t) i * a->col_stride] : a->value;
+		arith_row(&m->data[(size_t) i * m->stride], a->row_vector, value, m->cols, a->op);
+	}
+}
+
+/*
+	PURPOSE: Reduces every row of a band into dest
+	INPUT: arg - the Reduce_Args_t
+		row_begin, row_end - rows of the band
+	RETURN: Nothing
+*/
+static void reduce_rows_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	Reduce_Args_t* r = arg;
+	const Matrix_t* m = r->m;
+
+	for (unsigned int i = row_begin; i < row_end; ++i) {
+		r->dest->data[(size_t) i * r->dest->stride] = reduce_row(&m->data[(size_t) i * m->stride], m->cols, r->op);
+	}
+}
+
+/*
+	PURPOSE: Folds a band's rows into a private partial row, then merges it
+		into dest
+	INPUT: arg - the Reduce_Args_t
+		row_begin, row_end - rows of the band
+	RETURN: Nothing
+*/
+static void reduce_cols_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	Reduce_Args_t* r = arg;
+	const Matrix_t* m = r->m;
+	unsigned int* partial = malloc((size_t) m->cols * sizeof(unsigned int));
+	if (!partial) {
+		r->failed = true;
+		return;
+	}
+
+	memcpy(partial, &m->data[(size_t) row_begin * m->stride], (size_t) m->cols * sizeof(unsigned int));
+	for (unsigned int i = row_begin + 1; i < row_end; ++i) {
+		combine_row(partial, &m->data[(size_t) i * m->stride], m->cols, r->op);
+	}
+
+	pthread_mutex_lock(&r->lock);
+	combine_row(r->dest->data, partial, m->cols, r->op);
+	pthread_mutex_unlock(&r->lock);
+	free(partial);
+}
+
+/*
+	PURPOSE: Adds up a band of rows in 64 bits and adds it to the total
+	INPUT: arg - the Reduce_Args_t
+		row_begin, row_end - rows of the band
+	RETURN: Nothing
+*/
+static void sum_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	Reduce_Args_t* r = arg;
+	const Matrix_t* m = r->m;
+	unsigned long long total = 0;
+
+	for (unsigned int i = row_begin; i < row_end; ++i) {
+		const unsigned int* row = &m->data[(size_t) i * m->stride];
+		unsigned int j = 0;
+#ifdef __SSE2__
+		/* widen each group of 4 to two pairs of 64 bit lanes */
+		const __m128i zero = _mm_setzero_si128();
+		__m128i acc = zero;
+		for (; j + 4 <= m->cols; j += 4) {
+			const __m128i v = _mm_loadu_si128((const __m128i*) &row[j]);
+			acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+			acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+		}
+		unsigned long long lanes[2];
+		_mm_storeu_si128((__m128i*) lanes, acc);
+		total += lanes[0] + lanes[1];
+#endif
+		for (; j < m->cols; ++j) {
+			total += row[j];
+		}
+	}
+	__sync_fetch_and_add(&r->sum, total);
+}
+
+/*
+	PURPOSE: Checks if two matrices share data through views
+	INPUT: a, b - the matrices
+	RETURN: If they have the same owner returns true
+		else false
+*/
+static bool same_data (const Matrix_t* a, const Matrix_t* b) {
+	const Matrix_t* owner_a = a->parent ? a->parent : a;
+	const Matrix_t* owner_b = b->parent ? b->parent : b;
+	return owner_a == owner_b;
+}
+
+#ifdef __SSE2__
+/*
+	PURPOSE: Low 32 bits of four 32 bit products, SSE2 only has 32 x 32 -> 64
+		on the even lanes
+	INPUT: a, b - the operands
+	RETURN: a * b per lane
+*/
+static inline __m128i mullo_epi32 (__m128i a, __m128i b) {
+	const __m128i even = _mm_mul_epu32(a, b);
+	const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+				_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/*
+	PURPOSE: Unsigned per lane minimum, SSE2 only compares signed so the
+		sign bits are flipped first
+	INPUT: a, b - the operands
+	RETURN: min(a, b) per lane
+*/
+static inline __m128i min_epu32 (__m128i a, __m128i b) {
+	const __m128i bias = _mm_set1_epi32((int) 0x80000000U);
+	const __m128i a_greater = _mm_cmpgt_epi32(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+	return _mm_or_si128(_mm_and_si128(a_greater, b), _mm_andnot_si128(a_greater, a));
+}
+
+/*
+	PURPOSE: Unsigned per lane maximum
+	INPUT: a, b - the operands
+	RETURN: max(a, b) per lane
+*/
+static inline __m128i max_epu32 (__m128i a, __m128i b) {
+	const __m128i bias = _mm_set1_epi32((int) 0x80000000U);
+	const __m128i a_greater = _mm_cmpgt_epi32(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+	return _mm_or_si128(_mm_and_si128(a_greater, a), _mm_andnot_si128(a_greater, b));
+}
+#endif
@@ -0,0 +1,27 @@
+#ifndef _ARITH_H_
+#define _ARITH_H_
+
+/* element ops of scalar and broadcast, unsigned 32 bit and wrapping like add */
+typedef enum {
+	ARITH_ADD,
+	ARITH_MUL,
+	ARITH_AND,
+	ARITH_OR,
+	ARITH_XOR
+}Arith_Op_t;
+
+typedef enum {
+	REDUCE_SUM,	/* wraps at 32 bits, sum_matrix keeps 64 */
+	REDUCE_MIN,
+	REDUCE_MAX
+}Reduce_Op_t;
+
+bool parse_arith_op (const char* word, Arith_Op_t* op);
+bool parse_reduce_op (const char* word, Reduce_Op_t* op);
+bool scalar_matrix (Matrix_t* m, Arith_Op_t op, unsigned int value);
+bool broadcast_matrix (Matrix_t* m, Arith_Op_t op, Matrix_t* vector);
+bool reduce_matrix_rows (Matrix_t* m, Reduce_Op_t op, Matrix_t* dest);
+bool reduce_matrix_cols (Matrix_t* m, Reduce_Op_t op, Matrix_t* dest);
+bool sum_matrix (Matrix_t* m, unsigned long long* sum);
+
+#endif
@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "matrix.h"
+#include "parallel.h"
+#include "checkpoint.h"
+
+/*
+ * The first checkpoint of a matrix to a file writes all of it and starts
+ * dirty tracking. After that the mutating kernels flag the row blocks they
+ * change. Checkpointing to the same file again pwrites only those blocks
+ * in place and updates their checksums, and a matrix with no flagged
+ * blocks is not written at all. Every checkpoint stamps a new id into the
+ * sidecar and the matrix, so if anything else checkpointed to the file in
+ * between, the ids differ and the matrix is written in full. Views are not tracked on their own and
+ * are always written in full.
+ */
+
+/* each thread of a parallel checkpoint handles at least this many blocks */
+#define CHECKPOINT_MIN_BAND_BLOCKS 16
+
+typedef struct {
+	int fd;
+	off_t data_offset;
+	const Matrix_t* m;
+	const unsigned char* dirty;	/* blocks to write, NULL for all of them */
+	unsigned long long* checksums;
+	bool failed;
+}Checkpoint_Args_t;
+
+typedef struct {
+	int fd;
+	off_t data_offset;
+	unsigned int rows;
+	unsigned int cols;
+	const unsigned long long* checksums;
+	unsigned int bad_block;		/* first block that doesn't match, blocks if none */
+	bool failed;
+}Verify_Args_t;
+
+typedef struct {
+	unsigned long long lane[4];
+}Checksum_t;
+
+/*protected functions*/
+static char* sidecar_filename (const char* matrix_filename);
+static unsigned long long new_checkpoint_id (void);
+static bool pread_full (int fd, void* buf, size_t len, off_t offset);
+static bool pwrite_full (int fd, const void* buf, size_t len, off_t offset);
+static void checksum_init (Checksum_t* c);
+static void checksum_row (Checksum_t* c, const unsigned int* row, unsigned int cols);
+static unsigned long long checksum_final (const Checksum_t* c);
+static void checkpoint_band (void* arg, unsigned int block_begin, unsigned int block_end);
+static void verify_band (void* arg, unsigned int block_begin, unsigned int block_end);
+
+/*
+	PURPOSE: Writes a matrix to a file, only rewriting the row blocks that
+		changed since its last checkpoint to the same file
+	INPUT: matrix_output_filename - the matrix file, its checksums go to
+			matrix_output_filename.ck
+		m - matrix to checkpoint
+		written_blocks - set to the number of row blocks written
+	RETURN: If successful returns true
+		else false
+*/
+bool checkpoint_matrix (const char* matrix_output_filename, Matrix_t* m, unsigned int* written_blocks) {
+
+	if (!matrix_output_filename)
+	{
+		printf("No filename!\n");
+		return false;
+	}
+	if (!m || !m->data || !written_blocks)
+	{
+		printf("No matrix and/or data!\n");
+		return false;
+	}
+	*written_blocks = 0;
+
+	const unsigned int name_len = strlen(m->name) + 1;
+	const off_t data_offset = 3 * sizeof(unsigned int) + name_len;
+	const off_t data_end = data_offset + (off_t) m->rows * m->cols * sizeof(unsigned int);
+	const unsigned int blocks = (m->rows + MATRIX_DIRTY_BLOCK_ROWS - 1) / MATRIX_DIRTY_BLOCK_ROWS;
+	const size_t table_bytes = sizeof(Checkpoint_Header_t) + blocks * sizeof(unsigned long long);
+	Checkpoint_Header_t* table = calloc(1, table_bytes);
+	char* sidecar = sidecar_filename(matrix_output_filename);
+	char* sidecar_tmp = sidecar ? sidecar_filename(sidecar) : NULL;
+	Checkpoint_Args_t args = { -1, data_offset, m, NULL, (unsigned long long*) (table + 1), false };
+	bool ok = false;
+
+	if (!table || !sidecar || !sidecar_tmp) {
+		goto done;
+	}
+
+	/* incremental only when the file and checksums are the ones we left,
+	 * which the sidecar's id tells apart from another matrix's checkpoint */
+	bool incremental = !m->parent && m->dirty && m->checkpoint_file
+		&& strcmp(m->checkpoint_file, matrix_output_filename) == 0;
+	if (incremental) {
+		struct stat st;
+		args.fd = open(matrix_output_filename, O_RDWR);
+		int ck = open(sidecar, O_RDONLY);
+		incremental = args.fd >= 0 && ck >= 0 && fstat(args.fd, &st) == 0 && st.st_size == data_end + 1
+			&& pread_full(ck, table, table_bytes, 0) && table->magic == CHECKPOINT_MAGIC
+			&& table->version == CHECKPOINT_VERSION && table->id == m->checkpoint_id
+			&& table->rows == m->rows && table->cols == m->cols && table->blocks == blocks;
+		if (ck >= 0) {
+			close(ck);
+		}
+		if (!incremental && args.fd >= 0) {
+			close(args.fd);
+			args.fd = -1;
+		}
+	}
+	if (incremental) {
+		args.dirty = m->dirty;
+		for (unsigned int b = 0; b < blocks; ++b) {
+			*written_blocks += m->dirty[b];
+		}
+		if (*written_blocks == 0) {
+			ok = true;
+			goto done;
+		}
+	}
+	else {
+		args.fd = open(matrix_output_filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
+		const unsigned char eof = EOF;
+		if (args.fd < 0 || !pwrite_full(args.fd, &name_len, sizeof(unsigned int), 0)
+			|| !pwrite_full(args.fd, m->name, name_len, sizeof(unsigned int))
+			|| !pwrite_full(args.fd, &m->rows, sizeof(unsigned int), sizeof(unsigned int) + name_len)
+			|| !pwrite_full(args.fd, &m->cols, sizeof(unsigned int), 2 * sizeof(unsigned int) + name_len)
+			|| !pwrite_full(args.fd, &eof, 1, data_end)) {
+			perror("FAILED TO CREATE CHECKPOINT FILE\n");
+			goto done;
+		}
+		*written_blocks = blocks;
+	}
+
+	parallel_for_rows("checkpoint", m->name, blocks, m->cols, CHECKPOINT_MIN_BAND_BLOCKS, checkpoint_band, &args);
+	if (args.failed) {
+		goto done;
+	}
+	/* the checksums only ever describe data that reached the disk */
+	if (fdatasync(args.fd)) {
+		perror("FAILED TO SYNC CHECKPOINT FILE\n");
+		goto done;
+	}
+
+	table->magic = CHECKPOINT_MAGIC;
+	table->version = CHECKPOINT_VERSION;
+	table->rows = m->rows;
+	table->cols = m->cols;
+	table->block_rows = MATRIX_DIRTY_BLOCK_ROWS;
+	table->blocks = blocks;
+	table->id = new_checkpoint_id();
+	int ck = open(sidecar_tmp, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if (ck < 0 || !pwrite_full(ck, table, table_bytes, 0) || close(ck) || rename(sidecar_tmp, sidecar)) {
+		perror("FAILED TO WRITE CHECKPOINT CHECKSUMS\n");
+		if (ck >= 0) {
+			unlink(sidecar_tmp);
+		}
+		goto done;
+	}
+
+	if (!m->parent) {
+		if (!m->dirty) {
+			m->dirty = calloc(blocks, sizeof(unsigned char));
+		}
+		else {
+			memset(m->dirty, 0, blocks);
+		}
+		if (!m->checkpoint_file || strcmp(m->checkpoint_file, matrix_output_filename) != 0) {
+			free(m->checkpoint_file);
+			m->checkpoint_file = strdup(matrix_output_filename);
+		}
+		m->checkpoint_id = table->id;
+	}
+	ok = true;
+
+done:
+	if (!ok && !m->parent) {
+		/* whatever is on disk now, the next checkpoint starts over */
+		free(m->checkpoint_file);
+		m->checkpoint_file = NULL;
+	}
+	if (args.fd >= 0) {
+		close(args.fd);
+	}
+	free(table);
+	free(sidecar);
+	free(sidecar_tmp);
+	return ok;
+}
+
+/*
+	PURPOSE: Checks a checkpointed matrix file against its checksums
+	INPUT: matrix_input_filename - the matrix file, the checksums are read
+			from matrix_input_filename.ck
+	RETURN: If every row block matches returns true
+		else false
+*/
+bool verify_checkpoint (const char* matrix_input_filename) {
+
+	if (!matrix_input_filename)
+	{
+		printf("No filename!\n");
+		return false;
+	}
+
+	char* sidecar = sidecar_filename(matrix_input_filename);
+	int fd = open(matrix_input_filename, O_RDONLY);
+	int ck = sidecar ? open(sidecar, O_RDONLY) : -1;
+	Checkpoint_Header_t header;
+	unsigned long long* checksums = NULL;
+	unsigned int name_len = 0;
+	unsigned int dims[2] = { 0, 0 };
+	struct stat st;
+	bool ok = false;
+
+	if (fd < 0 || ck < 0) {
+		perror("FAILED TO OPEN CHECKPOINT\n");
+		goto done;
+	}
+	if (!pread_full(ck, &header, sizeof(header), 0) || header.magic != CHECKPOINT_MAGIC
+		|| header.version != CHECKPOINT_VERSION || header.block_rows != MATRIX_DIRTY_BLOCK_ROWS
+		|| !pread_full(fd, &name_len, sizeof(unsigned int), 0) || name_len == 0 || name_len > MATRIX_NAME_LEN
+		|| !pread_full(fd, dims, sizeof(dims), sizeof(unsigned int) + name_len)
+		|| dims[0] != header.rows || dims[1] != header.cols
+		|| header.blocks != (header.rows + MATRIX_DIRTY_BLOCK_ROWS - 1) / MATRIX_DIRTY_BLOCK_ROWS
+		|| fstat(fd, &st)
+		|| st.st_size < (off_t) (3 * sizeof(unsigned int) + name_len) + (off_t) header.rows * header.cols * sizeof(unsigned int)) {
+		printf("%s doesn't match its checkpoint header\n", matrix_input_filename);
+		goto done;
+	}
+	checksums = malloc(header.blocks * sizeof(unsigned long long) + 1);
+	if (!checksums || !pread_full(ck, checksums, header.blocks * sizeof(unsigned long long), sizeof(header))) {
+		printf("FAILED TO READ CHECKPOINT CHECKSUMS\n");
+		goto done;
+	}
+
+	Verify_Args_t args = { fd, 3 * sizeof(unsigned int) + name_len, header.rows, header.cols,
+				checksums, header.blocks, false };
+	parallel_for_rows("verify", matrix_input_filename, header.blocks, header.cols,
+			CHECKPOINT_MIN_BAND_BLOCKS, verify_band, &args);
+	if (args.failed) {
+		printf("FAILED TO READ CHECKPOINT DATA\n");
+		goto done;
+	}
+	if (args.bad_block < header.blocks) {
+		printf("Rows [%u,%u) of %s don't match the last checkpoint\n", args.bad_block * MATRIX_DIRTY_BLOCK_ROWS,
+			(args.bad_block + 1) * MATRIX_DIRTY_BLOCK_ROWS < header.rows
+			? (args.bad_block + 1) * MATRIX_DIRTY_BLOCK_ROWS : header.rows, matrix_input_filename);
+		goto done;
+	}
+	ok = true;
+
+done:
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (ck >= 0) {
+		close(ck);
+	}
+	free(checksums);
+	free(sidecar);
+	return ok;
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: Name of the checksum file of a matrix file
+	INPUT: matrix_filename - the matrix file
+	RETURN: matrix_filename with ".ck" appended, to be freed by the caller
+*/
+static char* sidecar_filename (const char* matrix_filename) {
+	const size_t len = strlen(matrix_filename);
+	char* sidecar = malloc(len + sizeof(".ck"));
+	if (sidecar) {
+		memcpy(sidecar, matrix_filename, len);
+		memcpy(sidecar + len, ".ck", sizeof(".ck"));
+	}
+	return sidecar;
+}
+
+/*
+	PURPOSE: Makes an id for a new checkpoint, different from any other
+		checkpoint of this or another process
+	INPUT: Nothing
+	RETURN: The id, never 0
+*/
+static unsigned long long new_checkpoint_id (void) {
+	static unsigned long long counter = 0;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	const unsigned long long id = ((unsigned long long) getpid() << 40)
+		^ ((unsigned long long) now.tv_sec * 1000000000ULL + now.tv_nsec)
+		^ (__sync_add_and_fetch(&counter, 1) * 0x9e3779b97f4a7c15ULL);
+	return id ? id : 1;
+}
+
+/*
+	PURPOSE: Reads exactly len bytes at an offset, retrying short reads
+	INPUT: fd - file to read
+		buf - where the bytes go
+		len - number of bytes
+		offset - file offset of the first byte
+	RETURN: If all bytes were read returns true
+		else false
+*/
+static bool pread_full (int fd, void* buf, size_t len, off_t offset) {
+	unsigned char* out = buf;
+	while (len > 0) {
+		ssize_t got = pread(fd, out, len, offset);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			return false;
+		}
+		out += got;
+		len -= got;
+		offset += got;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Writes all of a buffer at an offset, retrying short writes
+	INPUT: fd - file to write
+		buf - bytes to write
+		len - number of bytes
+		offset - file offset of the first byte
+	RETURN: If everything was written returns true
+		else false
+*/
+static bool pwrite_full (int fd, const void* buf, size_t len, off_t offset) {
+	const unsigned char* in = buf;
+	while (len > 0) {
+		ssize_t put = pwrite(fd, in, len, offset);
+		if (put < 0 && errno == EINTR) {
+			continue;
+		}
+		if (put <= 0) {
+			return false;
+		}
+		in += put;
+		len -= put;
+		offset += put;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Starts a row block checksum
+	INPUT: c - the checksum
+	RETURN: Nothing
+*/
+static void checksum_init (Checksum_t* c) {
+	for (unsigned int i = 0; i < 4; ++i) {
+		c->lane[i] = 0xcbf29ce484222325ULL + i;
+	}
+}
+
+/*
+	PURPOSE: Adds a row to a checksum. FNV-1a over whole words, in four
+		independent lanes so the multiplies overlap
+	INPUT: c - the checksum
+		row - the row
+		cols - elements in the row
+	RETURN: Nothing
+*/
+static void checksum_row (Checksum_t* c, const unsigned int* row, unsigned int cols) {
+	unsigned long long h0 = c->lane[0], h1 = c->lane[1], h2 = c->lane[2], h3 = c->lane[3];
+	unsigned int j = 0;
+	for (; j + 4 <= cols; j += 4) {
+		h0 = (h0 ^ row[j]) * 0x100000001b3ULL;
+		h1 = (h1 ^ row[j + 1]) * 0x100000001b3ULL;
+		h2 = (h2 ^ row[j + 2]) * 0x100000001b3ULL;
+		h3 = (h3 ^ row[j + 3]) * 0x100000001b3ULL;
+	}
+	for (; j < cols; ++j) {
+		h0 = (h0 ^ row[j]) * 0x100000001b3ULL;
+	}
+	c->lane[0] = h0;
+	c->lane[1] = h1;
+	c->lane[2] = h2;
+	c->lane[3] = h3;
+}
+
+/*
+	PURPOSE: Folds the lanes of a checksum into one value
+	INPUT: c - the checksum
+	RETURN: The checksum
+*/
+static unsigned long long checksum_final (const Checksum_t* c) {
+	unsigned long long h = c->lane[0];
+	for (unsigned int i = 1; i < 4; ++i) {
+		h = (h ^ c->lane[i]) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+/*
+	PURPOSE: Writes the flagged row blocks of a band and checksums them
+	INPUT: arg - the Checkpoint_Args_t
+		block_begin, block_end - row blocks of the band
+	RETURN: Nothing
+*/
+static void checkpoint_band (void* arg, unsigned int block_begin, unsigned int block_end) {
+	Checkpoint_Args_t* c = arg;
+	const Matrix_t* m = c->m;
+	const size_t row_bytes = (size_t) m->cols * sizeof(unsigned int);
+
+	for (unsigned int b = block_begin; b < block_end && !c->failed; ++b) {
+		if (c->dirty && !c->dirty[b]) {
+			continue;
+		}
+		const unsigned int row_begin = b * MATRIX_DIRTY_BLOCK_ROWS;
+		const unsigned int row_end = row_begin + MATRIX_DIRTY_BLOCK_ROWS < m->rows
+			? row_begin + MATRIX_DIRTY_BLOCK_ROWS : m->rows;
+		Checksum_t sum;
+		checksum_init(&sum);
+		for (unsigned int i = row_begin; i < row_end; ++i) {
+			checksum_row(&sum, &m->data[(size_t) i * m->stride], m->cols);
+		}
+		c->checksums[b] = checksum_final(&sum);
+
+		/* views are written row by row, whole matrices a block at a time */
+		const unsigned int rows = m->stride == m->cols ? row_end - row_begin : 1;
+		for (unsigned int i = row_begin; i < row_end; i += rows) {
+			if (!pwrite_full(c->fd, &m->data[(size_t) i * m->stride], rows * row_bytes,
+					c->data_offset + (off_t) i * row_bytes)) {
+				perror("FAILED TO WRITE CHECKPOINT DATA\n");
+				c->failed = true;
+				break;
+			}
+		}
+	}
+}
+
+/*
+	PURPOSE: Rereads the row blocks of a band from the file and compares
+		their checksums
+	INPUT: arg - the Verify_Args_t
+		block_begin, block_end - row blocks of the band
+	RETURN: Nothing
+*/
+static void verify_band (void* arg, unsigned int block_begin, unsigned int block_end) {
+	Verify_Args_t* v = arg;
+	const size_t row_bytes = (size_t) v->cols * sizeof(unsigned int);
+	unsigned int* row = malloc(row_bytes);
+	if (!row) {
+		v->failed = true;
+		return;
+	}
+
+	for (unsigned int b = block_begin; b < block_end; ++b) {
+		const unsigned int row_begin = b * MATRIX_DIRTY_BLOCK_ROWS;
+		const unsigned int row_end = row_begin + MATRIX_DIRTY_BLOCK_ROWS < v->rows
+			? row_begin + MATRIX_DIRTY_BLOCK_ROWS : v->rows;
+		Checksum_t sum;
+		checksum_init(&sum);
+		for (unsigned int i = row_begin; i < row_end; ++i) {
+			if (!pread_full(v->fd, row, row_bytes, v->data_offset + (off_t) i * row_bytes)) {
+				v->failed = true;
+				free(row);
+				return;
+			}
+			checksum_row(&sum, row, v->cols);
+		}
+		if (checksum_final(&sum) != v->checksums[b]) {
+			/* keep the lowest bad block across bands */
+			unsigned int seen = v->bad_block;
+			while (b < seen && !__sync_bool_compare_and_swap(&v->bad_block, seen, b)) {
+				seen = v->bad_block;
+			}
+			break;
+		}
+	}
+	free(row);
+}
@@ -0,0 +1,27 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+/*
+ * A checkpoint is a matrix file in the write_matrix layout plus a sidecar
+ * "<file>.ck" holding a Checkpoint_Header_t and one checksum per
+ * MATRIX_DIRTY_BLOCK_ROWS rows, so readers can tell whether the data
+ * they see matches the last completed checkpoint.
+ */
+
+#define CHECKPOINT_MAGIC 0x4b43544dU	/* "MTCK" */
+#define CHECKPOINT_VERSION 2
+
+typedef struct {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int rows;
+	unsigned int cols;
+	unsigned int block_rows;
+	unsigned int blocks;	/* unsigned long long checksums that follow */
+	unsigned long long id;	/* new for every checkpoint, the matrix that wrote it keeps a copy */
+}Checkpoint_Header_t;
+
+bool checkpoint_matrix (const char* matrix_output_filename, Matrix_t* m, unsigned int* written_blocks);
+bool verify_checkpoint (const char* matrix_input_filename);
+
+#endif
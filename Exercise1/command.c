@@ -8,6 +8,9 @@
 #define MAX_CMD_COUNT 50
 #define MAX_CMD_LEN 25
 
+/* where the results of commands run on this thread are printed */
+static __thread FILE* output = NULL;
+
 
 	//TODO FUNCTION COMMENT
 	/*
@@ -35,12 +38,14 @@
 	char *token;
 	token = strtok(string, " \n");
 	for (; token != NULL && i < MAX_CMD_COUNT; ++i) {
-		(*cmd)->cmds[i] = calloc(MAX_CMD_LEN,sizeof(char));
+		/* never copy more than was allocated */
+		const size_t len = strlen(token) + 1;
+		(*cmd)->cmds[i] = calloc(len > MAX_CMD_LEN ? len : MAX_CMD_LEN,sizeof(char));
 		if (!(*cmd)->cmds[i]) {
 			perror("Allocation Error\n");
 			return false;
 		}	
-		strncpy((*cmd)->cmds[i],token, strlen(token) + 1);
+		memcpy((*cmd)->cmds[i],token, len);
 		(*cmd)->num_cmds++;
 		token = strtok(NULL, " \n");
 	}
@@ -71,3 +76,20 @@
 	*cmd = NULL;
 }
 
+/*
+	PURPOSE: Stream the results of commands run on this thread go to
+	INPUT: Nothing
+	RETURN: The stream set by set_command_output, stdout by default
+*/
+FILE* command_output (void) {
+	return output ? output : stdout;
+}
+
+/*
+	PURPOSE: Sends the results of commands run on this thread to a stream
+	INPUT: out - stream for command results, NULL for stdout
+	RETURN: Nothing
+*/
+void set_command_output (FILE* out) {
+	output = out;
+}
@@ -8,5 +8,7 @@ typedef struct {
 
 bool parse_user_input (const char* input, Commands_t** cmd);
 void destroy_commands(Commands_t** cmd);
+FILE* command_output (void);
+void set_command_output (FILE* out);
 
 #endif
@@ -10,6 +10,17 @@
 
 #include "command.h"
 #include "matrix.h"
+#include "arith.h"
+#include "checkpoint.h"
+#include "parallel.h"
+#include "record.h"
+#include "server.h"
+#include "session.h"
+#include "shard.h"
+#include "shm.h"
+#include "stats.h"
+#include "text.h"
+#include "trace.h"
 
 void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats);
 unsigned int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats, 
@@ -18,44 +29,132 @@ unsigned int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats,
 // TODO complete the defintion of this function.
 void destroy_remaining_heap_allocations(Matrix_t **mats, unsigned int num_mats);
 
+static Matrix_t* result_matrix (Matrix_t** mats, unsigned int num_mats, const char* name,
+			unsigned int rows, unsigned int cols, int* dest_idx);
+static bool store_result (Matrix_t** mats, unsigned int num_mats, int dest_idx, Matrix_t* result);
+static void discard_result (Matrix_t** mats, int dest_idx, Matrix_t** result);
+
 //TODO FUNCTION COMMENT
 /*
 	PURPOSE: main function to add a temporary matrix to an array of matrices
-	INPUT: No inputs used
+	INPUT: argv - optional "--trace <file>" to record a Chrome trace of the session,
+		"--serve <socket>" to serve the matrices to clients instead of reading
+		commands, "--restore <session_file>" to start from a saved workspace,
+		"--record <file>" to log every command with its latency,
+		"--replay <file>" with "--sessions <n>" and "--pacing fast|recorded"
+		to rerun a recording and report latencies,
+		or "--connect <socket>" to run commands on a server
 	RETURN: 0 if successful
 		-1 if it failed
 */
 int main (int argc, char **argv) {
 	srand(time(NULL));		
 	char *line = NULL;
+	const char* serve_path = NULL;
+	const char* restore_path = NULL;
+	const char* replay_path = NULL;
+	unsigned int replay_sessions = 1;
+	bool replay_paced = false;
+
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc) {
+			printf("Missing value for %s\n", argv[i]);
+			return -1;
+		}
+		if (strncmp(argv[i],"--trace",strlen("--trace") + 1) == 0) {
+			if (!trace_open(argv[i + 1])) {
+				printf("Failed to open trace file!\n");
+				return -1;
+			}
+		}
+		else if (strncmp(argv[i],"--serve",strlen("--serve") + 1) == 0) {
+			serve_path = argv[i + 1];
+		}
+		else if (strncmp(argv[i],"--record",strlen("--record") + 1) == 0) {
+			if (!record_open(argv[i + 1])) {
+				printf("Failed to open record file!\n");
+				return -1;
+			}
+		}
+		else if (strncmp(argv[i],"--replay",strlen("--replay") + 1) == 0) {
+			replay_path = argv[i + 1];
+		}
+		else if (strncmp(argv[i],"--sessions",strlen("--sessions") + 1) == 0) {
+			replay_sessions = atoi(argv[i + 1]);
+		}
+		else if (strncmp(argv[i],"--pacing",strlen("--pacing") + 1) == 0) {
+			replay_paced = strncmp(argv[i + 1],"recorded",strlen("recorded") + 1) == 0;
+		}
+		else if (strncmp(argv[i],"--restore",strlen("--restore") + 1) == 0) {
+			restore_path = argv[i + 1];
+		}
+		else if (strncmp(argv[i],"--connect",strlen("--connect") + 1) == 0) {
+			return run_matrix_client(argv[i + 1]);
+		}
+		else {
+			printf("Unknown option %s\n", argv[i]);
+			return -1;
+		}
+	}
 	Commands_t* cmd;
 
 	Matrix_t *mats[10];
 	memset(&mats,0, sizeof(Matrix_t*) * 10); // IMPORTANT C FUNCTION TO LEARN
 
-	Matrix_t *temp = NULL;
-	if (!create_matrix (&temp,"temp_mat", 5, 5))
-	{
-		printf("Failed to initialize matrix!\n");
-		return -1;
-	} // TODO ERROR CHECK
-	if (!add_matrix_to_array(mats,temp, 10))
-	{
-		printf("Failed to add matrix to array!\n");
-		return -1;
-	} //TODO ERROR CHECK NEEDED
-	int mat_idx = find_matrix_given_name(mats,10,"temp_mat");
+	if (restore_path) {
+		/* the saved workspace replaces the usual temp_mat */
+		unsigned int restored = 0;
+		if (!load_session(restore_path, mats, 10, &restored)) {
+			printf("Failed to restore session!\n");
+			return -1;
+		}
+		printf("Restored %u matrices from %s\n", restored, restore_path);
+	}
+	else {
+		Matrix_t *temp = NULL;
+		if (!create_matrix (&temp,"temp_mat", 5, 5))
+		{
+			printf("Failed to initialize matrix!\n");
+			return -1;
+		} // TODO ERROR CHECK
+		if (add_matrix_to_array(mats,temp, 10) == -1)
+		{
+			printf("Failed to add matrix to array!\n");
+			return -1;
+		} //TODO ERROR CHECK NEEDED
+		int mat_idx = find_matrix_given_name(mats,10,"temp_mat");
 
-	if (mat_idx < 0) {
-		perror("PROGRAM FAILED TO INIT\n");
-		return -1;
+		if (mat_idx < 0) {
+			perror("PROGRAM FAILED TO INIT\n");
+			return -1;
+		}
+		random_matrix(mats[mat_idx], 10, 15);
+		if (!write_matrix("temp_mat", mats[mat_idx]))
+		{
+			printf("Could not write matrix to file!\n");
+			return -1;
+		} // TODO ERROR CHECK
+	}
+
+	if (replay_path) {
+		const int replayed = replay_session(replay_path, replay_sessions, replay_paced, mats, 10, run_commands);
+		record_close();
+		trace_close();
+		shard_shutdown();
+		parallel_shutdown();
+		destroy_remaining_heap_allocations(mats,10);
+		return replayed;
+	}
+
+	if (serve_path) {
+		const int served = serve_matrices(serve_path, mats, 10, run_commands);
+		record_close();
+		trace_close();
+		shard_shutdown();
+		parallel_shutdown();
+		destroy_remaining_heap_allocations(mats,10);
+		return served;
 	}
-	random_matrix(mats[mat_idx], 10, 15);
-	if (!write_matrix("temp_mat", mats[mat_idx]))
-	{
-		printf("Could not write matrix to file!\n");
-		return -1;
-	} // TODO ERROR CHECK
 
 	line = readline("> ");
 	while (strncmp(line,"exit", strlen("exit")  + 1) != 0) {
@@ -65,7 +164,11 @@ int main (int argc, char **argv) {
 		}
 		
 		if (cmd->num_cmds > 1) {	
+			record_command_begin(cmd,mats,10);
+			trace_command_begin(cmd);
 			run_commands(cmd,mats,10);
+			trace_command_end(cmd);
+			record_command_end(cmd);
 		}
 		if (line) {
 			free(line);
@@ -74,6 +177,10 @@ int main (int argc, char **argv) {
 		line = readline("> ");
 	}
 	free(line);
+	record_close();
+	trace_close();
+	shard_shutdown();
+	parallel_shutdown();
 	destroy_remaining_heap_allocations(mats,10);
 	return 0;	
 }
@@ -90,98 +197,100 @@ void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats) {
 	//TODO ERROR CHECK INCOMING PARAMETERS
 	if (!cmd || !(cmd)->cmds)
 	{
-		printf("No commands to run!\n");
+		fprintf(command_output(), "No commands to run!\n");
 		return;
 	}
 	if (!mats || !(*mats))
 	{
-		printf("No matrices to run commands on!\n");
+		fprintf(command_output(), "No matrices to run commands on!\n");
 		return;
 	}
 	if (num_mats <= 0)
 	{
-		printf("Need more matrices!\n");
+		fprintf(command_output(), "Need more matrices!\n");
 		return;
 	}
 
 	/*Parsing and calling of commands*/
 	if (strncmp(cmd->cmds[0],"display",strlen("display") + 1) == 0
-		&& cmd->num_cmds == 2) {
+		&& (cmd->num_cmds == 2 || (cmd->num_cmds == 3
+			&& strncmp(cmd->cmds[2],"full",strlen("full") + 1) == 0))) {
 			/*find the requested matrix*/
 			int idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
 			if (idx >= 0) {
-				display_matrix (mats[idx]);
+				display_matrix (mats[idx], cmd->num_cmds == 3);
 			}
 			else {
-				printf("Matrix (%s) doesn't exist\n", cmd->cmds[1]);
+				fprintf(command_output(), "Matrix (%s) doesn't exist\n", cmd->cmds[1]);
 				return;
 			}
 	}
 	else if (strncmp(cmd->cmds[0],"add",strlen("add") + 1) == 0
-		&& cmd->num_cmds == 4) {
+		&& cmd->num_cmds == 4 && strlen(cmd->cmds[3]) + 1 <= MATRIX_NAME_LEN) {
 			int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
 			int mat2_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[2]);
 			if (mat1_idx >= 0 && mat2_idx >= 0) {
-				Matrix_t* c = NULL;
-				if( !create_matrix (&c,cmd->cmds[3], mats[mat1_idx]->rows, 
-						mats[mat1_idx]->cols)) {
-					printf("Failure to create the result Matrix (%s)\n", cmd->cmds[3]);
+				/* an existing result matrix of the same size is written into,
+				 * even if it is a or b */
+				int mat3_idx = -1;
+				Matrix_t* c = result_matrix(mats, num_mats, cmd->cmds[3], mats[mat1_idx]->rows,
+						mats[mat1_idx]->cols, &mat3_idx);
+				if (!c) {
+					fprintf(command_output(), "Failure to create the result Matrix (%s)\n", cmd->cmds[3]);
 					return;
 				}
-			
-				if (!add_matrix_to_array(mats,c, num_mats))
-				{
-					printf("Could not add matrix to array!\n");
-					return;
-				} //TODO ERROR CHECK NEEDED
-
 
 				if (! add_matrices(mats[mat1_idx], mats[mat2_idx],c) ) {
-					printf("Failure to add %s with %s into %s\n", mats[mat1_idx]->name, mats[mat2_idx]->name,c->name);
+					fprintf(command_output(), "Failure to add %s with %s into %s\n", mats[mat1_idx]->name, mats[mat2_idx]->name,c->name);
+					discard_result(mats, mat3_idx, &c);
 					return;	
 				}
+				if (!store_result(mats, num_mats, mat3_idx, c)) {
+					return;
+				}
 			}
 	}
 	else if (strncmp(cmd->cmds[0],"duplicate",strlen("duplicate") + 1) == 0
-		&& cmd->num_cmds == 3 && strlen(cmd->cmds[1]) + 1 <= MATRIX_NAME_LEN) {
+		&& cmd->num_cmds == 3 && strlen(cmd->cmds[2]) + 1 <= MATRIX_NAME_LEN) {
 		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
 		if (mat1_idx >= 0 ) {
-				Matrix_t* dup_mat = NULL;
-				if( !create_matrix (&dup_mat,cmd->cmds[2], mats[mat1_idx]->rows, 
-						mats[mat1_idx]->cols)) {
+				/* an existing destination with the same dimensions is overwritten */
+				int mat2_idx = -1;
+				Matrix_t* dup_mat = result_matrix(mats, num_mats, cmd->cmds[2], mats[mat1_idx]->rows,
+						mats[mat1_idx]->cols, &mat2_idx);
+				if (!dup_mat) {
 					return;
 				}
 				if (!duplicate_matrix (mats[mat1_idx], dup_mat))
 				{
-					printf("Could not duplicate matrix!\n");
+					fprintf(command_output(), "Could not duplicate matrix!\n");
+					discard_result(mats, mat2_idx, &dup_mat);
 					return;
-				} //TODO ERROR CHECK NEEDED
-				if (!add_matrix_to_array(mats,dup_mat,num_mats))
-				{
-					printf("Could not add matrix to array!\n");
+				}
+				if (!store_result(mats, num_mats, mat2_idx, dup_mat)) {
 					return;
-				} //TODO ERROR CHECK NEEDED
-				printf ("Duplication of %s into %s finished\n", mats[mat1_idx]->name, cmd->cmds[2]);
+				}
+				fprintf(command_output(), "Duplication of %s into %s finished\n", mats[mat1_idx]->name, cmd->cmds[2]);
 		}
 		else {
-			printf("Duplication Failed\n");
+			fprintf(command_output(), "Duplication Failed\n");
 			return;
 		}
 	}
 	else if (strncmp(cmd->cmds[0],"equal",strlen("equal") + 1) == 0
-		&& cmd->num_cmds == 2) {
+		&& cmd->num_cmds == 3) {
 			int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
 			int mat2_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[2]);
 			if (mat1_idx >= 0 && mat2_idx >= 0) {
 				if ( equal_matrices(mats[mat1_idx],mats[mat2_idx]) ) {
-					printf("SAME DATA IN BOTH\n");
+					fprintf(command_output(), "SAME DATA IN BOTH\n");
 				}
 				else {
-					printf("DIFFERENT DATA IN BOTH\n");
+					fprintf(command_output(), "DIFFERENT DATA IN BOTH\n");
 				}
 			}
 			else {
-				printf("Equal Failed\n");
+				fprintf(command_output(), "Equal Failed\n");
 				return;
 			}
 	}
@@ -192,13 +301,13 @@ void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats) {
 		if (mat1_idx >= 0 ) {
 			if (!bitwise_shift_matrix(mats[mat1_idx],cmd->cmds[2][0], shift_value))
 			{
-				printf("Could not bit shift matrix!\n");
+				fprintf(command_output(), "Could not bit shift matrix!\n");
 				return;
 			} //TODO ERROR CHECK NEEDED
-			printf("Matrix (%s) has been shifted by %d\n", mats[mat1_idx]->name, shift_value);
+			fprintf(command_output(), "Matrix (%s) has been shifted by %d\n", mats[mat1_idx]->name, shift_value);
 		}
 		else {
-			printf("Matrix shift failed\n");
+			fprintf(command_output(), "Matrix shift failed\n");
 			return;
 		}
 
@@ -207,28 +316,65 @@ void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats) {
 		&& cmd->num_cmds == 2) {
 		Matrix_t* new_matrix = NULL;
 		if(! read_matrix(cmd->cmds[1],&new_matrix)) {
-			printf("Read Failed\n");
+			fprintf(command_output(), "Read Failed\n");
 			return;
 		}	
 		
 		if (!add_matrix_to_array(mats,new_matrix, num_mats))
 		{
-			printf("Could not add matrix to array!\n");
+			fprintf(command_output(), "Could not add matrix to array!\n");
 			return;
 		} //TODO ERROR CHECK NEEDED
-		printf("Matrix (%s) is read from the filesystem\n", cmd->cmds[1]);	
+		fprintf(command_output(), "Matrix (%s) is read from the filesystem\n", cmd->cmds[1]);	
+	}
+	else if (strncmp(cmd->cmds[0],"read",strlen("read") + 1) == 0
+		&& cmd->num_cmds == 4) {
+		Matrix_t* new_matrix = NULL;
+		const unsigned int row_begin = atoi(cmd->cmds[2]);
+		const unsigned int row_end = atoi(cmd->cmds[3]);
+		if (!read_matrix_rows(cmd->cmds[1],row_begin,row_end,&new_matrix)) {
+			fprintf(command_output(), "Read Failed\n");
+			return;
+		}
+		if (add_matrix_to_array(mats,new_matrix,num_mats) == -1) {
+			fprintf(command_output(), "Could not add matrix to array!\n");
+			destroy_matrix(&new_matrix);
+			return;
+		}
+		fprintf(command_output(), "Rows [%u,%u) of matrix (%s) are read from the filesystem\n", row_begin,
+				row_begin + new_matrix->rows, cmd->cmds[1]);
 	}
 	else if (strncmp(cmd->cmds[0],"write",strlen("write") + 1) == 0
 		&& cmd->num_cmds == 2) {
 		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		if(! write_matrix(mats[mat1_idx]->name,mats[mat1_idx])) {
-			printf("Write Failed\n");
+		if(mat1_idx < 0 || ! write_matrix(mats[mat1_idx]->name,mats[mat1_idx])) {
+			fprintf(command_output(), "Write Failed\n");
 			return;
 		}
 		else {
-			printf("Matrix (%s) is wrote out to the filesystem\n", mats[mat1_idx]->name);
+			fprintf(command_output(), "Matrix (%s) is wrote out to the filesystem\n", mats[mat1_idx]->name);
 		}
 	}
+	else if (strncmp(cmd->cmds[0],"checkpoint",strlen("checkpoint") + 1) == 0
+		&& (cmd->num_cmds == 2 || cmd->num_cmds == 3)) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		unsigned int written = 0;
+		if (mat1_idx < 0 || !checkpoint_matrix(cmd->num_cmds == 3 ? cmd->cmds[2] : mats[mat1_idx]->name,
+				mats[mat1_idx],&written)) {
+			fprintf(command_output(), "Checkpoint Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Matrix (%s) is checkpointed, %u row blocks written\n",
+				mats[mat1_idx]->name, written);
+	}
+	else if (strncmp(cmd->cmds[0],"verify",strlen("verify") + 1) == 0
+		&& cmd->num_cmds == 2) {
+		if (!verify_checkpoint(cmd->cmds[1])) {
+			fprintf(command_output(), "Verify Failed\n");
+			return;
+		}
+		fprintf(command_output(), "%s matches its last checkpoint\n", cmd->cmds[1]);
+	}
 	else if (strncmp(cmd->cmds[0], "create", strlen("create") + 1) == 0
 		&& strlen(cmd->cmds[1]) + 1 <= MATRIX_NAME_LEN && cmd->num_cmds == 4) {
 		Matrix_t* new_mat = NULL;
@@ -237,31 +383,344 @@ void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats) {
 
 		if (!create_matrix(&new_mat,cmd->cmds[1],rows, cols))
 		{
-			printf("Could not create matrix!\n");
+			fprintf(command_output(), "Could not create matrix!\n");
 			return;
 		} //TODO ERROR CHECK NEEDED
 		if (!add_matrix_to_array(mats,new_mat,num_mats))
 		{
-			printf("Could not add matrix to array!\n");
+			fprintf(command_output(), "Could not add matrix to array!\n");
 			return;
 		} // TODO ERROR CHECK NEEDED
-		printf("Created Matrix (%s,%u,%u)\n", new_mat->name, new_mat->rows, new_mat->cols);
+		fprintf(command_output(), "Created Matrix (%s,%u,%u)\n", new_mat->name, new_mat->rows, new_mat->cols);
 	}
 	else if (strncmp(cmd->cmds[0], "random", strlen("random") + 1) == 0
 		&& cmd->num_cmds == 4) {
 		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
 		const unsigned int start_range = atoi(cmd->cmds[2]);
 		const unsigned int end_range = atoi(cmd->cmds[3]);
-		if (!random_matrix(mats[mat1_idx],start_range, end_range))
+		if (mat1_idx < 0 || !random_matrix(mats[mat1_idx],start_range, end_range))
 		{
-			printf("Could not fill matrix with random numbers!\n");
+			fprintf(command_output(), "Could not fill matrix with random numbers!\n");
 			return;
 		} //TODO ERROR CHECK NEEDED
 
-		printf("Matrix (%s) is randomized between %u %u\n", mats[mat1_idx]->name, start_range, end_range);
+		fprintf(command_output(), "Matrix (%s) is randomized between %u %u\n", mats[mat1_idx]->name, start_range, end_range);
+	}
+	else if (strncmp(cmd->cmds[0], "transpose", strlen("transpose") + 1) == 0
+		&& cmd->num_cmds == 2) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		if (mat1_idx < 0 || !transpose_matrix_in_place(mats[mat1_idx])) {
+			fprintf(command_output(), "Transpose Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Matrix (%s) has been transposed\n", mats[mat1_idx]->name);
+	}
+	else if (strncmp(cmd->cmds[0], "transpose", strlen("transpose") + 1) == 0
+		&& cmd->num_cmds == 3 && strlen(cmd->cmds[2]) + 1 <= MATRIX_NAME_LEN) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		if (mat1_idx < 0) {
+			fprintf(command_output(), "Transpose Failed\n");
+			return;
+		}
+		/* an existing destination of the transposed size is written into */
+		int mat2_idx = -1;
+		Matrix_t* trans_mat = result_matrix(mats, num_mats, cmd->cmds[2], mats[mat1_idx]->cols,
+				mats[mat1_idx]->rows, &mat2_idx);
+		if (!trans_mat) {
+			fprintf(command_output(), "Could not create matrix!\n");
+			return;
+		}
+		if (!transpose_matrix(mats[mat1_idx],trans_mat)) {
+			fprintf(command_output(), "Transpose Failed\n");
+			discard_result(mats, mat2_idx, &trans_mat);
+			return;
+		}
+		if (!store_result(mats, num_mats, mat2_idx, trans_mat)) {
+			return;
+		}
+		fprintf(command_output(), "Transpose of %s into %s finished\n", cmd->cmds[1], cmd->cmds[2]);
+	}
+	else if (strncmp(cmd->cmds[0], "scalar", strlen("scalar") + 1) == 0
+		&& cmd->num_cmds == 4) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		Arith_Op_t op;
+		if (mat1_idx < 0 || !parse_arith_op(cmd->cmds[2], &op)
+			|| !scalar_matrix(mats[mat1_idx], op, strtoul(cmd->cmds[3], NULL, 10))) {
+			fprintf(command_output(), "Scalar Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Matrix (%s) has been updated with %s %s\n", mats[mat1_idx]->name, cmd->cmds[2], cmd->cmds[3]);
+	}
+	else if (strncmp(cmd->cmds[0], "broadcast", strlen("broadcast") + 1) == 0
+		&& cmd->num_cmds == 4) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		int mat2_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[3]);
+		Arith_Op_t op;
+		if (mat1_idx < 0 || mat2_idx < 0 || !parse_arith_op(cmd->cmds[2], &op)
+			|| !broadcast_matrix(mats[mat1_idx], op, mats[mat2_idx])) {
+			fprintf(command_output(), "Broadcast Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Matrix (%s) has been updated with %s %s\n", mats[mat1_idx]->name, cmd->cmds[2], cmd->cmds[3]);
+	}
+	else if (strncmp(cmd->cmds[0], "reduce", strlen("reduce") + 1) == 0
+		&& cmd->num_cmds == 5 && strlen(cmd->cmds[4]) + 1 <= MATRIX_NAME_LEN) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		const bool by_rows = strcmp(cmd->cmds[2], "rows") == 0;
+		Reduce_Op_t op;
+		if (mat1_idx < 0 || (!by_rows && strcmp(cmd->cmds[2], "cols") != 0)
+			|| !parse_reduce_op(cmd->cmds[3], &op)) {
+			fprintf(command_output(), "Reduce Failed\n");
+			return;
+		}
+		/* an existing destination of the reduced size is written into */
+		int mat2_idx = -1;
+		Matrix_t* reduced = result_matrix(mats, num_mats, cmd->cmds[4], by_rows ? mats[mat1_idx]->rows : 1,
+				by_rows ? 1 : mats[mat1_idx]->cols, &mat2_idx);
+		if (!reduced) {
+			fprintf(command_output(), "Could not create matrix!\n");
+			return;
+		}
+		if (!(by_rows ? reduce_matrix_rows(mats[mat1_idx], op, reduced)
+				: reduce_matrix_cols(mats[mat1_idx], op, reduced))) {
+			fprintf(command_output(), "Reduce Failed\n");
+			discard_result(mats, mat2_idx, &reduced);
+			return;
+		}
+		if (!store_result(mats, num_mats, mat2_idx, reduced)) {
+			return;
+		}
+		fprintf(command_output(), "Reduction of %s into %s finished\n", cmd->cmds[1], cmd->cmds[4]);
+	}
+	else if (strncmp(cmd->cmds[0], "shard", strlen("shard") + 1) == 0
+		&& (cmd->num_cmds == 2 || cmd->num_cmds == 3)) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		const char* name = cmd->num_cmds == 3 ? cmd->cmds[2] : cmd->cmds[1];
+		if (mat1_idx < 0 || !shard_scatter(mats[mat1_idx], name)) {
+			fprintf(command_output(), "Shard Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Matrix (%s) is sharded as %s\n", cmd->cmds[1], name);
+	}
+	else if (strncmp(cmd->cmds[0], "gather", strlen("gather") + 1) == 0
+		&& (cmd->num_cmds == 2 || cmd->num_cmds == 3)) {
+		const char* name = cmd->num_cmds == 3 ? cmd->cmds[2] : cmd->cmds[1];
+		int mat1_idx = find_matrix_given_name(mats,num_mats,name);
+		Matrix_t* gathered = NULL;
+		if (mat1_idx >= 0 || !shard_gather(cmd->cmds[1], name, &gathered)) {
+			fprintf(command_output(), "Gather Failed\n");
+			return;
+		}
+		if (add_matrix_to_array(mats,gathered,num_mats) == -1) {
+			fprintf(command_output(), "Could not add matrix to array!\n");
+			destroy_matrix(&gathered);
+			return;
+		}
+		fprintf(command_output(), "Sharded matrix (%s) is gathered into %s\n", cmd->cmds[1], name);
+	}
+	else if (strncmp(cmd->cmds[0], "shard-create", strlen("shard-create") + 1) == 0
+		&& cmd->num_cmds == 4) {
+		const unsigned int rows = atoi(cmd->cmds[2]);
+		const unsigned int cols = atoi(cmd->cmds[3]);
+		if (!shard_create(cmd->cmds[1], rows, cols)) {
+			fprintf(command_output(), "Shard Create Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Created Sharded Matrix (%s,%u,%u)\n", cmd->cmds[1], rows, cols);
+	}
+	else if (strncmp(cmd->cmds[0], "shard-read", strlen("shard-read") + 1) == 0
+		&& cmd->num_cmds == 3) {
+		if (!shard_read(cmd->cmds[1], cmd->cmds[2])) {
+			fprintf(command_output(), "Shard Read Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Sharded matrix (%s) is read from %s\n", cmd->cmds[2], cmd->cmds[1]);
+	}
+	else if (strncmp(cmd->cmds[0], "shard-write", strlen("shard-write") + 1) == 0
+		&& cmd->num_cmds == 3) {
+		if (!shard_write(cmd->cmds[1], cmd->cmds[2])) {
+			fprintf(command_output(), "Shard Write Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Sharded matrix (%s) is written to %s.<worker>\n", cmd->cmds[1], cmd->cmds[2]);
+	}
+	else if (strncmp(cmd->cmds[0], "shard-load", strlen("shard-load") + 1) == 0
+		&& cmd->num_cmds == 3) {
+		if (!shard_load(cmd->cmds[1], cmd->cmds[2])) {
+			fprintf(command_output(), "Shard Load Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Sharded matrix (%s) is loaded from %s.<worker>\n", cmd->cmds[2], cmd->cmds[1]);
+	}
+	else if (strncmp(cmd->cmds[0], "shard-add", strlen("shard-add") + 1) == 0
+		&& cmd->num_cmds == 4) {
+		if (!shard_add(cmd->cmds[1], cmd->cmds[2], cmd->cmds[3])) {
+			fprintf(command_output(), "Failure to add %s with %s into %s\n", cmd->cmds[1], cmd->cmds[2], cmd->cmds[3]);
+			return;
+		}
+	}
+	else if (strncmp(cmd->cmds[0], "shard-shift", strlen("shard-shift") + 1) == 0
+		&& cmd->num_cmds == 4) {
+		const unsigned int shift_value = atoi(cmd->cmds[3]);
+		if (!shard_shift(cmd->cmds[1], cmd->cmds[2][0], shift_value)) {
+			fprintf(command_output(), "Could not bit shift matrix!\n");
+			return;
+		}
+		fprintf(command_output(), "Sharded matrix (%s) has been shifted by %s\n", cmd->cmds[1], cmd->cmds[3]);
+	}
+	else if (strncmp(cmd->cmds[0], "shard-sum", strlen("shard-sum") + 1) == 0
+		&& cmd->num_cmds == 2) {
+		unsigned long long sum = 0;
+		if (!shard_sum(cmd->cmds[1], &sum)) {
+			fprintf(command_output(), "Sum Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Sum of (%s) is %llu\n", cmd->cmds[1], sum);
+	}
+	else if (strncmp(cmd->cmds[0], "shard-equal", strlen("shard-equal") + 1) == 0
+		&& cmd->num_cmds == 3) {
+		bool equal = false;
+		if (!shard_equal(cmd->cmds[1], cmd->cmds[2], &equal)) {
+			fprintf(command_output(), "Equal Failed\n");
+			return;
+		}
+		fprintf(command_output(), equal ? "SAME DATA IN BOTH\n" : "DIFFERENT DATA IN BOTH\n");
+	}
+	else if (strncmp(cmd->cmds[0], "shard-drop", strlen("shard-drop") + 1) == 0
+		&& cmd->num_cmds == 2) {
+		if (!shard_drop(cmd->cmds[1])) {
+			fprintf(command_output(), "Shard Drop Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Sharded matrix (%s) is dropped\n", cmd->cmds[1]);
+	}
+	else if (strncmp(cmd->cmds[0], "stats", strlen("stats") + 1) == 0
+		&& cmd->num_cmds == 2) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		Matrix_Stats_t* stats = malloc(sizeof(Matrix_Stats_t));
+		if (mat1_idx < 0 || !stats || !matrix_stats(mats[mat1_idx], stats)) {
+			fprintf(command_output(), "Stats Failed\n");
+			free(stats);
+			return;
+		}
+		display_stats(mats[mat1_idx]->name, stats, command_output());
+		free(stats);
+	}
+	else if (strncmp(cmd->cmds[0], "sum", strlen("sum") + 1) == 0
+		&& cmd->num_cmds == 2) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		unsigned long long sum = 0;
+		if (mat1_idx < 0 || !sum_matrix(mats[mat1_idx], &sum)) {
+			fprintf(command_output(), "Sum Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Sum of (%s) is %llu\n", mats[mat1_idx]->name, sum);
+	}
+	else if (strncmp(cmd->cmds[0], "export", strlen("export") + 1) == 0
+		&& (cmd->num_cmds == 3 || cmd->num_cmds == 4)) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		/* the format comes from the 4th argument, else the file extension */
+		const char* format = cmd->num_cmds == 4 ? cmd->cmds[3] : strrchr(cmd->cmds[2], '.');
+		char delimiter = ',';
+		if (format && (strcmp(format, "tsv") == 0 || strcmp(format, ".tsv") == 0)) {
+			delimiter = '\t';
+		}
+		if (mat1_idx < 0 || !export_matrix(cmd->cmds[2],mats[mat1_idx],delimiter)) {
+			fprintf(command_output(), "Export Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Matrix (%s) is exported to %s\n", mats[mat1_idx]->name, cmd->cmds[2]);
+	}
+	else if (strncmp(cmd->cmds[0], "import", strlen("import") + 1) == 0
+		&& cmd->num_cmds == 3 && strlen(cmd->cmds[1]) + 1 <= MATRIX_NAME_LEN) {
+		Matrix_t* new_matrix = NULL;
+		if (!import_matrix(cmd->cmds[2],cmd->cmds[1],&new_matrix)) {
+			fprintf(command_output(), "Import Failed\n");
+			return;
+		}
+		if (add_matrix_to_array(mats,new_matrix,num_mats) == -1) {
+			fprintf(command_output(), "Could not add matrix to array!\n");
+			destroy_matrix(&new_matrix);
+			return;
+		}
+		fprintf(command_output(), "Imported Matrix (%s,%u,%u) from %s\n", new_matrix->name, new_matrix->rows,
+				new_matrix->cols, cmd->cmds[2]);
+	}
+	else if (strncmp(cmd->cmds[0], "publish", strlen("publish") + 1) == 0
+		&& (cmd->num_cmds == 2 || cmd->num_cmds == 3)) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		char shm_name[MATRIX_NAME_LEN + 8];
+		snprintf(shm_name, sizeof(shm_name), "/matlab.%s", cmd->cmds[1]);
+		if (mat1_idx < 0 || !publish_matrix(mats[mat1_idx],cmd->num_cmds == 3 ? cmd->cmds[2] : shm_name)) {
+			fprintf(command_output(), "Publish Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Matrix (%s) is published as %s\n", mats[mat1_idx]->name,
+				mats[mat1_idx]->shm_name);
+	}
+	else if (strncmp(cmd->cmds[0], "attach", strlen("attach") + 1) == 0
+		&& (cmd->num_cmds == 2 || cmd->num_cmds == 3)) {
+		Matrix_t* new_matrix = NULL;
+		if (!attach_matrix(cmd->cmds[1],cmd->num_cmds == 3 ? cmd->cmds[2] : NULL,&new_matrix)) {
+			fprintf(command_output(), "Attach Failed\n");
+			return;
+		}
+		if (add_matrix_to_array(mats,new_matrix,num_mats) == -1) {
+			fprintf(command_output(), "Could not add matrix to array!\n");
+			destroy_matrix(&new_matrix);
+			return;
+		}
+		fprintf(command_output(), "Attached Matrix (%s,%u,%u) from %s\n", new_matrix->name, new_matrix->rows,
+				new_matrix->cols, cmd->cmds[1]);
+	}
+	else if (strncmp(cmd->cmds[0], "save-session", strlen("save-session") + 1) == 0
+		&& cmd->num_cmds == 2) {
+		if (!save_session(cmd->cmds[1],mats,num_mats)) {
+			fprintf(command_output(), "Session Save Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Session is saved to %s\n", cmd->cmds[1]);
+	}
+	else if (strncmp(cmd->cmds[0], "load-session", strlen("load-session") + 1) == 0
+		&& cmd->num_cmds == 2) {
+		unsigned int loaded = 0;
+		if (!load_session(cmd->cmds[1],mats,num_mats,&loaded)) {
+			fprintf(command_output(), "Session Load Failed\n");
+			return;
+		}
+		fprintf(command_output(), "Loaded %u matrices from %s\n", loaded, cmd->cmds[1]);
+	}
+	else if (strncmp(cmd->cmds[0], "slice", strlen("slice") + 1) == 0
+		&& cmd->num_cmds == 6 && strlen(cmd->cmds[2]) + 1 <= MATRIX_NAME_LEN) {
+		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
+		const unsigned int begin = atoi(cmd->cmds[4]);
+		const unsigned int end = atoi(cmd->cmds[5]);
+		if (mat1_idx < 0) {
+			fprintf(command_output(), "Slice Failed\n");
+			return;
+		}
+		Matrix_t* src = mats[mat1_idx];
+		Matrix_t* view = NULL;
+		bool sliced = false;
+		if (strncmp(cmd->cmds[3], "rows", strlen("rows") + 1) == 0) {
+			sliced = slice_matrix(&view,cmd->cmds[2],src,begin,end,0,src->cols);
+		}
+		else if (strncmp(cmd->cmds[3], "cols", strlen("cols") + 1) == 0) {
+			sliced = slice_matrix(&view,cmd->cmds[2],src,0,src->rows,begin,end);
+		}
+		if (!sliced) {
+			fprintf(command_output(), "Slice Failed\n");
+			return;
+		}
+		if (add_matrix_to_array(mats,view,num_mats) == -1) {
+			fprintf(command_output(), "Could not add matrix to array!\n");
+			destroy_matrix(&view);
+			return;
+		}
+		fprintf(command_output(), "Matrix (%s) is a view of %s %s [%u,%u)\n", view->name, cmd->cmds[1], cmd->cmds[3], begin, end);
 	}
 	else {
-		printf("Not a command in this application\n");
+		fprintf(command_output(), "Not a command in this application\n");
 	}
 
 }
@@ -278,22 +737,22 @@ unsigned int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats, con
 	//TODO ERROR CHECK INCOMING PARAMETERS
 	if (!mats || !(*mats))
 	{
-		printf("No matrices to find!\n");
+		fprintf(command_output(), "No matrices to find!\n");
 		return -1;
 	}
 	if (num_mats <= 0)
 	{
-		printf("Not enough matrices!\n");
+		fprintf(command_output(), "Not enough matrices!\n");
 		return -1;
 	}
 	if (!target || strcmp(target, "\n") == 0)
 	{
-		printf("No target to find!\n");
+		fprintf(command_output(), "No target to find!\n");
 		return -1;
 	}
 	
 	for (int i = 0; i < num_mats; ++i) {
-		if (strncmp(mats[i]->name,target,strlen(mats[i]->name)) == 0) {
+		if (mats[i] && strncmp(mats[i]->name,target,MATRIX_NAME_LEN) == 0) {
 			return i;
 		}
 	}
@@ -316,27 +775,79 @@ void destroy_remaining_heap_allocations(Matrix_t **mats, unsigned int num_mats)
 		printf("No matrices to destroy!\n");
 		return;
 	}
-	// COMPLETE MISSING MEMORY CLEARING HERE
+	/* destroy_matrix keeps a parent's data alive until its views are gone */
 	int i;
 	for (i = 0; i < num_mats; i++)
 	{
-		if (!(*mats+i))
+		if (mats[i])
 		{
-			printf("Couldn't find matrix at %d\n", i+1);
+			destroy_matrix(&mats[i]);
 		}
-		else
-		{
-			if (!(*mats+i)->data)
-			{
-				printf("Couldn't find data in matrix %d! Freeing matrix\n", i+1);
-				free(*mats+i);
-			}
-			else
-			{
-				free((*mats+i)->data);
-				free(*mats+i);
-				*mats+i = NULL;
-			}
+	}
+}
+
+/*
+	PURPOSE: Gets the matrix a command writes its rows x cols result to.
+		An existing matrix with that name and size is reused, otherwise
+		a new one is created, which store_result puts in the old one's
+		slot once the result is in it
+	INPUT: mats - array of matrices
+		num_mats - number of matrices
+		name - name of the result
+		rows, cols - size of the result
+		dest_idx - set to the slot of the existing matrix, -1 if there is none
+	RETURN: The result matrix, NULL if it could not be created
+*/
+static Matrix_t* result_matrix (Matrix_t** mats, unsigned int num_mats, const char* name,
+			unsigned int rows, unsigned int cols, int* dest_idx) {
+	*dest_idx = find_matrix_given_name(mats,num_mats,name);
+	if (*dest_idx >= 0 && mats[*dest_idx]->rows == rows && mats[*dest_idx]->cols == cols) {
+		return mats[*dest_idx];
+	}
+	Matrix_t* result = NULL;
+	if (!create_matrix_uninitialized(&result,name,rows,cols)) {
+		return NULL;
+	}
+	return result;
+}
+
+/*
+	PURPOSE: Keeps a result from result_matrix. A new matrix replaces the
+		one with its name, or is added to mats if there was none
+	INPUT: mats - array of matrices
+		num_mats - number of matrices
+		dest_idx - the slot result_matrix found
+		result - the result
+	RETURN: If the result is in mats returns true
+		else false, and the result is destroyed
+*/
+static bool store_result (Matrix_t** mats, unsigned int num_mats, int dest_idx, Matrix_t* result) {
+	if (dest_idx >= 0) {
+		if (mats[dest_idx] != result) {
+			destroy_matrix(&mats[dest_idx]);
+			mats[dest_idx] = result;
 		}
+		return true;
+	}
+	if (add_matrix_to_array(mats,result,num_mats) == -1) {
+		fprintf(command_output(), "Could not add matrix to array!\n");
+		destroy_matrix(&result);
+		return false;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Drops a result from result_matrix after the command failed,
+		a reused matrix stays in mats
+	INPUT: mats - array of matrices
+		dest_idx - the slot result_matrix found
+		result - the result, set to NULL
+	RETURN: Nothing
+*/
+static void discard_result (Matrix_t** mats, int dest_idx, Matrix_t** result) {
+	if (dest_idx < 0 || mats[dest_idx] != *result) {
+		destroy_matrix(result);
 	}
+	*result = NULL;
 }
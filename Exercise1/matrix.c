@@ -2,21 +2,90 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
+#include "command.h"
 #include "matrix.h"
+#include "parallel.h"
+#include "text.h"
+#include "trace.h"
 
 
 #define MAX_CMD_COUNT 50
 
+/* transpose works on 8x8 register blocks grouped into 64x64 tiles */
+#define TRANSPOSE_BLOCK 8
+#define TRANSPOSE_TILE_BLOCKS 8
+
+typedef struct {
+	const unsigned int* src;
+	unsigned int src_stride;
+	unsigned int* dest;
+	unsigned int dest_stride;
+	unsigned int src_rows;
+}Transpose_Args_t;
+
+/* matrices at least this big get their pages placed by the workers that
+ * process them instead of by the thread that creates them */
+#define NUMA_MIN_BYTES (4 << 20)
+/* memory policies from <numaif.h>, used through the raw syscall so
+ * libnuma is not needed */
+#define NUMA_MPOL_BIND 2
+#define NUMA_MPOL_INTERLEAVE 3
+
+typedef enum {
+	NUMA_FIRST_TOUCH,	/* pages land on the node of the band's worker */
+	NUMA_BIND,		/* same, but the kernel may not fall back to other nodes */
+	NUMA_INTERLEAVE		/* pages are spread round robin over every node */
+}Numa_Policy_t;
+
+typedef struct {
+	char* base;
+	size_t row_bytes;
+	size_t page;
+	Numa_Policy_t policy;
+}Place_Rows_Args_t;
+
+/* each thread of a parallel read preads at least this much */
+#define READ_MIN_BAND_BYTES (1 << 20)
+
+typedef struct {
+	int fd;
+	off_t data_offset;
+	Matrix_t* m;
+	unsigned int first_row;
+	bool failed;
+}Read_Rows_Args_t;
+
 /*protected functions*/
 void load_matrix (Matrix_t* m, unsigned int* data);
+static void transpose_block (const unsigned int* src, unsigned int src_stride,
+			unsigned int* dest, unsigned int dest_stride);
+static void transpose_band (void* arg, unsigned int row_begin, unsigned int row_end);
+static void transpose_in_place_band (void* arg, unsigned int pair_begin, unsigned int pair_end);
+static void report_file_error (const char* msg);
+static bool pread_full (int fd, void* buf, size_t len, off_t offset);
+static bool read_matrix_header (int fd, char* name, unsigned int* rows, unsigned int* cols, off_t* data_offset);
+static void read_rows_band (void* arg, unsigned int row_begin, unsigned int row_end);
+static bool new_matrix_data (Matrix_t** new_matrix, const char* name, const unsigned int rows,
+				const unsigned int cols, bool zero);
+static bool alloc_matrix_data (Matrix_t* m, bool zero);
+static bool same_region (const Matrix_t* a, const Matrix_t* b);
+static bool shares_data (const Matrix_t* a, const Matrix_t* b);
+static Numa_Policy_t numa_policy (void);
+static void place_rows_band (void* arg, unsigned int row_begin, unsigned int row_end);
 
 /* 
  * PURPOSE: instantiates a new matrix with the passed name, rows, cols 
@@ -31,41 +100,77 @@ void load_matrix (Matrix_t* m, unsigned int* data);
  **/
 
 bool create_matrix (Matrix_t** new_matrix, const char* name, const unsigned int rows, const unsigned int cols) {
+	return new_matrix_data(new_matrix, name, rows, cols, true);
+}
 
-	//TODO ERROR CHECK INCOMING PARAMETERS
-	if ((*new_matrix) != NULL)
+/*
+	PURPOSE: Like create_matrix, but the data is left uninitialized. For
+		matrices every element of which is written right away
+	INPUT: new_matrix - must point to NULL
+		name - the name of the matrix
+		rows, cols - the dimensions
+	RETURN: If successful returns true
+		else false
+*/
+bool create_matrix_uninitialized (Matrix_t** new_matrix, const char* name, const unsigned int rows,
+				const unsigned int cols) {
+	return new_matrix_data(new_matrix, name, rows, cols, false);
+}
+
+/*
+        PURPOSE: Creates a view of rows [row_begin, row_end) and cols
+		[col_begin, col_end) of src without copying. The view shares
+		src's data and keeps it alive until the view is destroyed
+        INPUT: view - pointer to the new view, must point to NULL
+		name - the name of the view
+		src - matrix or view to be sliced
+		row_begin, row_end - row range of the view
+		col_begin, col_end - col range of the view
+        RETURN: If successful return true
+		else false
+*/
+
+bool slice_matrix (Matrix_t** view, const char* name, Matrix_t* src, const unsigned int row_begin,
+			const unsigned int row_end, const unsigned int col_begin, const unsigned int col_end) {
+
+	if (!view || (*view) != NULL)
 	{
 		printf("Matrix exists!\n");
 		return false;
 	}
-	if (!name || strcmp(name, "\n") == 0)
+	if (!name || strlen(name) + 1 > MATRIX_NAME_LEN)
 	{
 		printf("No name for new matrix!\n");
 		return false;
 	}
-	if (rows <= 0 || cols <= 0)
+	if (!src || !src->data)
 	{
-		printf("Not enough rows and or collumns!\n");
-		return false;
-	}
-
-	*new_matrix = calloc(1,sizeof(Matrix_t));
-	if (!(*new_matrix)) {
+		printf("No matrix and/or data!\n");
 		return false;
 	}
-	(*new_matrix)->data = calloc(rows * cols,sizeof(unsigned int));
-	if (!(*new_matrix)->data) {
+	if (row_begin >= row_end || row_end > src->rows || col_begin >= col_end || col_end > src->cols)
+	{
+		printf("Slice is outside of the %u x %u matrix!\n", src->rows, src->cols);
 		return false;
 	}
-	(*new_matrix)->rows = rows;
-	(*new_matrix)->cols = cols;
-	unsigned int len = strlen(name) + 1; 
-	if (len > MATRIX_NAME_LEN) {
+
+	*view = calloc(1,sizeof(Matrix_t));
+	if (!(*view)) {
 		return false;
 	}
-	strncpy((*new_matrix)->name,name,len);
+	/* views of views hang off the matrix that really owns the data */
+	Matrix_t* owner = src->parent ? src->parent : src;
+	__sync_fetch_and_add(&owner->refs, 1);
+
+	(*view)->parent = owner;
+	(*view)->rows = row_end - row_begin;
+	(*view)->cols = col_end - col_begin;
+	(*view)->stride = src->stride;
+	(*view)->offset = src->offset + row_begin * src->stride + col_begin;
+	(*view)->data = owner->data + (*view)->offset;
+	(*view)->refs = 1;
+	memcpy((*view)->name,name,strlen(name) + 1);
 	return true;
-
 }
 
 //TODO FUNCTION COMMENT
@@ -78,14 +183,38 @@ bool create_matrix (Matrix_t** new_matrix, const char* name, const unsigned int
 void destroy_matrix (Matrix_t** m) {
 
 	//TODO ERROR CHECK INCOMING PARAMETERS
-	if (!*m)
+	if (!m || !*m)
 	{
 		printf("Matrix doesn't exist!\n");
 		return;
 	}
 
-	free((*m)->data);
-	free(*m);
+	/* a view gives back its reference on the owner, the owner's data
+	 * lives until neither it nor any view of it is left */
+	Matrix_t* owner = (*m)->parent;
+	if (owner) {
+		free(*m);
+	}
+	else {
+		owner = *m;
+	}
+	if (__sync_sub_and_fetch(&owner->refs, 1) == 0) {
+		if (owner->mapping) {
+			/* published segments go away with their matrix, processes
+			 * that already mapped them keep their mapping */
+			if (owner->shm_name) {
+				shm_unlink(owner->shm_name);
+			}
+			munmap(owner->mapping, owner->mapping_len);
+		}
+		else {
+			free(owner->data);
+		}
+		free(owner->shm_name);
+		free(owner->dirty);
+		free(owner->checkpoint_file);
+		free(owner);
+	}
 	*m = NULL;
 }
 
@@ -107,7 +236,21 @@ bool equal_matrices (Matrix_t* a, Matrix_t* b) {
 		return false;	
 	}
 
-	int result = memcmp(a->data,b->data, sizeof(unsigned int) * a->rows * a->cols);
+	if (a->rows != b->rows || a->cols != b->cols) {
+		return false;
+	}
+
+	trace_begin("equal", a->name, a->rows, a->cols);
+	int result = 0;
+	if (a->stride == a->cols && b->stride == b->cols) {
+		result = memcmp(a->data,b->data, sizeof(unsigned int) * a->rows * a->cols);
+	}
+	else {
+		for (unsigned int i = 0; i < a->rows && result == 0; ++i) {
+			result = memcmp(&a->data[i * a->stride],&b->data[i * b->stride], sizeof(unsigned int) * a->cols);
+		}
+	}
+	trace_end("equal", a->name);
 	if (result == 0) {
 		return true;
 	}
@@ -139,9 +282,37 @@ bool duplicate_matrix (Matrix_t* src, Matrix_t* dest) {
 	/*
 	 * copy over data
 	 */
-	unsigned int bytesToCopy = sizeof(unsigned int) * src->rows * src->cols;
-	memcpy(dest->data,src->data, bytesToCopy);	
-	return equal_matrices (src,dest);
+	if (src->rows != dest->rows || src->cols != dest->cols)
+	{
+		printf("Source and destination dimensions differ!\n");
+		return false;
+	}
+	if (same_region(src, dest)) {
+		return true;
+	}
+	trace_begin("duplicate", src->name, src->rows, src->cols);
+	/* views of one matrix may overlap. Rows are copied starting from the
+	 * end the copy moves towards, so no source row is overwritten before
+	 * it is read */
+	const bool overlap = shares_data(src, dest);
+	if (src->stride == src->cols && dest->stride == dest->cols) {
+		unsigned int bytesToCopy = sizeof(unsigned int) * src->rows * src->cols;
+		memmove(dest->data,src->data, bytesToCopy);	
+	}
+	else if (overlap && dest->data > src->data) {
+		for (unsigned int i = src->rows; i-- > 0;) {
+			memmove(&dest->data[i * dest->stride],&src->data[i * src->stride], sizeof(unsigned int) * src->cols);
+		}
+	}
+	else {
+		for (unsigned int i = 0; i < src->rows; ++i) {
+			memmove(&dest->data[i * dest->stride],&src->data[i * src->stride], sizeof(unsigned int) * src->cols);
+		}
+	}
+	mark_matrix_dirty(dest, 0, dest->rows);
+	trace_end("duplicate", src->name);
+	/* an overlapping copy changes src, there is nothing to compare with */
+	return overlap || equal_matrices (src,dest);
 }
 
 //TODO FUNCTION COMMENT
@@ -167,12 +338,13 @@ bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift) {
 		return false;
 	}
 
+	trace_begin("shift", a->name, a->rows, a->cols);
 	if (direction == 'l') {
 		unsigned int i = 0;
 		for (; i < a->rows; ++i) {
 			unsigned int j = 0;
 			for (; j < a->cols; ++j) {
-				a->data[i * a->cols + j] = a->data[i * a->cols + j] << shift;
+				a->data[i * a->stride + j] = a->data[i * a->stride + j] << shift;
 			}
 		}
 
@@ -182,10 +354,12 @@ bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift) {
 		for (; i < a->rows; ++i) {
 			unsigned int j = 0;
 			for (; j < a->cols; ++j) {
-				a->data[i * a->cols + j] = a->data[i * a->cols + j] >> shift;
+				a->data[i * a->stride + j] = a->data[i * a->stride + j] >> shift;
 			}
 		}
 	}
+	mark_matrix_dirty(a, 0, a->rows);
+	trace_end("shift", a->name);
 	
 	return true;
 }
@@ -194,7 +368,7 @@ bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift) {
 /*
         PURPOSE: Add matrix a and b and put the result into matrix c
         INPUT: a, b - matrices to be added
-		c - matrix for the results to be stored
+		c - matrix for the results to be stored, may be a or b
         RETURN: If successful return true
 		else false
 */
@@ -207,27 +381,134 @@ bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
 		printf("One or more matrices are null!\n");
 		return false;
 	}
-	if (a->rows != b->rows && a->cols != b->cols) {
+	if (a->rows != b->rows || a->cols != b->cols
+		|| a->rows != c->rows || a->cols != c->cols) {
 		printf("Incompatible matrix rows and collumns!\n");
 		return false;
 	}
 
+	/* c may be a or b itself, every element is read before it is written.
+	 * A view overlapping an input at another offset would read results it
+	 * already wrote, so that case goes through a scratch copy */
+	Matrix_t* out = c;
+	Matrix_t* scratch = NULL;
+	if ((!same_region(c, a) && shares_data(c, a)) || (!same_region(c, b) && shares_data(c, b))) {
+		if (!create_matrix_uninitialized(&scratch, c->name, c->rows, c->cols)) {
+			return false;
+		}
+		out = scratch;
+	}
+
+	trace_begin("add", c->name, a->rows, a->cols);
 	for (int i = 0; i < a->rows; ++i) {
 		for (int j = 0; j < b->cols; ++j) {
-			c->data[i * a->cols +j] = a->data[i * a->cols + j] + b->data[i * a->cols + j];
+			out->data[i * out->stride +j] = a->data[i * a->stride + j] + b->data[i * b->stride + j];
+		}
+	}
+	if (scratch) {
+		for (unsigned int i = 0; i < c->rows; ++i) {
+			memcpy(&c->data[i * c->stride], &scratch->data[i * scratch->stride], sizeof(unsigned int) * c->cols);
+		}
+		destroy_matrix(&scratch);
+	}
+	mark_matrix_dirty(c, 0, c->rows);
+	trace_end("add", c->name);
+	return true;
+}
+
+/*
+        PURPOSE: Transpose src into dest. Works on 64x64 tiles made of 8x8
+		blocks that are transposed in registers, with dest row bands
+		split across the worker threads
+        INPUT: src - matrix to be transposed
+		dest - matrix with src's cols as rows and src's rows as cols
+        RETURN: If successful return true
+		else false
+*/
+
+bool transpose_matrix (Matrix_t* src, Matrix_t* dest) {
+
+	if (!src || !dest || !src->data || !dest->data)
+	{
+		printf("One or more matrices are null or don't have any data!\n");
+		return false;
+	}
+	if (src == dest || src->rows != dest->cols || src->cols != dest->rows)
+	{
+		printf("Destination must be a different %u x %u matrix!\n", src->cols, src->rows);
+		return false;
+	}
+
+	Transpose_Args_t args = { src->data, src->stride, dest->data, dest->stride, src->rows };
+	trace_begin("transpose", dest->name, dest->rows, dest->cols);
+	parallel_for_rows("transpose:band", dest->name, dest->rows, dest->cols,
+			PARALLEL_MIN_BAND_ROWS, transpose_band, &args);
+	mark_matrix_dirty(dest, 0, dest->rows);
+	trace_end("transpose", dest->name);
+	return true;
+}
+
+/*
+        PURPOSE: Transpose a square matrix in place by swapping mirrored
+		8x8 blocks tile by tile
+        INPUT: m - square matrix to be transposed
+        RETURN: If successful return true
+		else false
+*/
+
+bool transpose_matrix_in_place (Matrix_t* m) {
+
+	if (!m || !m->data)
+	{
+		printf("No matrix and/or data!\n");
+		return false;
+	}
+	if (m->rows != m->cols)
+	{
+		printf("Only square matrices can be transposed in place!\n");
+		return false;
+	}
+
+	const unsigned int n = m->rows;
+	const unsigned int stride = m->stride;
+	const unsigned int blocks = n / TRANSPOSE_BLOCK;
+	const unsigned int tiles = (blocks + TRANSPOSE_TILE_BLOCKS - 1) / TRANSPOSE_TILE_BLOCKS;
+	Transpose_Args_t args = { m->data, stride, m->data, stride, n };
+
+	trace_begin("transpose", m->name, m->rows, m->cols);
+	/* tile row p is paired with tile row tiles - 1 - p so every band gets
+	 * the same share of the upper triangle */
+	parallel_for_rows("transpose:band", m->name, (tiles + 1) / 2, m->cols,
+			1, transpose_in_place_band, &args);
+
+	/* rows and cols past the last full 8x8 block */
+	for (unsigned int i = 0; i < n; ++i) {
+		unsigned int j = blocks * TRANSPOSE_BLOCK;
+		if (j <= i) {
+			j = i + 1;
+		}
+		for (; j < n; ++j) {
+			const unsigned int tmp = m->data[i * stride + j];
+			m->data[i * stride + j] = m->data[j * stride + i];
+			m->data[j * stride + i] = tmp;
 		}
 	}
+	mark_matrix_dirty(m, 0, m->rows);
+	trace_end("transpose", m->name);
 	return true;
 }
 
 //TODO FUNCTION COMMENT
 /*
-        PURPOSE: Print matrix to screen
+        PURPOSE: Print matrix to the command output. Matrices with more than
+		TEXT_PREVIEW_LIMIT rows or cols only show their first and last
+		TEXT_PREVIEW_EDGE rows or cols unless full is set
         INPUT: m - matrix to be printed
+		full - print every element no matter the size
         RETURN: Nothing
 */
 
-void display_matrix (Matrix_t* m) {
+void display_matrix (Matrix_t* m, bool full) {
 	
 	//TODO ERROR CHECK INCOMING PARAMETERS
 	if (!m)
@@ -241,21 +522,32 @@ void display_matrix (Matrix_t* m) {
 		return;
 	}
 
-	printf("\nMatrix Contents (%s):\n", m->name);
-	printf("DIM = (%u,%u)\n", m->rows, m->cols);
-	for (int i = 0; i < m->rows; ++i) {
-		for (int j = 0; j < m->cols; ++j) {
-			printf("%u ", m->data[i * m->cols + j]);
-		}
-		printf("\n");
+	const bool preview_rows = !full && m->rows > TEXT_PREVIEW_LIMIT;
+	const unsigned int edge_cols = !full && m->cols > TEXT_PREVIEW_LIMIT ? TEXT_PREVIEW_EDGE : 0;
+
+	FILE* out = command_output();
+
+	trace_begin("display", m->name, m->rows, m->cols);
+	fprintf(out, "\nMatrix Contents (%s):\n", m->name);
+	fprintf(out, "DIM = (%u,%u)%s\n", m->rows, m->cols,
+			preview_rows || edge_cols ? " preview, use display <name> full for all of it" : "");
+	if (preview_rows) {
+		write_matrix_text(out, m, 0, TEXT_PREVIEW_EDGE, edge_cols, ' ', true);
+		fprintf(out, "...\n");
+		write_matrix_text(out, m, m->rows - TEXT_PREVIEW_EDGE, m->rows, edge_cols, ' ', true);
+	}
+	else {
+		write_matrix_text(out, m, 0, m->rows, edge_cols, ' ', true);
 	}
-	printf("\n");
+	fprintf(out, "\n");
+	trace_end("display", m->name);
 
 }
 
 //TODO FUNCTION COMMENT
 /*
-        PURPOSE: Read matrix from a file
+        PURPOSE: Read matrix from a file. The payload is split into row
+		bands that the worker threads pread concurrently
         INPUT: matrix_input_filename - file to read matrix from
 		m - matrix to put file matrix into
         RETURN: If successfull returns true
@@ -270,137 +562,110 @@ bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
 		printf("No filename!\n");
 		return false;
 	}
-	if (!m || !(*m)->data)
+	if (!m || *m)
 	{
-		printf("No matrix and/or data!\n");
+		printf("Matrix must point to NULL!\n");
+		return false;
+	}
+
+	return read_matrix_rows(matrix_input_filename, 0, UINT_MAX, m);
+}
+
+/*
+        PURPOSE: Read only rows [row_begin, row_end) of a matrix file. The
+		payload offset is computed from the header so nothing before
+		row_begin or after row_end is read
+        INPUT: matrix_input_filename - file to read matrix from
+		row_begin - first row to read
+		row_end - one past the last row to read, clamped to the file's rows
+		m - matrix to put the rows into, must point to NULL
+        RETURN: If successfull returns true
+		else false
+*/
+
+bool read_matrix_rows (const char* matrix_input_filename, const unsigned int row_begin,
+			unsigned int row_end, Matrix_t** m) {
+
+	if (!matrix_input_filename)
+	{
+		printf("No filename!\n");
+		return false;
+	}
+	if (!m || *m)
+	{
+		printf("Matrix must point to NULL!\n");
 		return false;
 	}
 
 	int fd = open(matrix_input_filename,O_RDONLY);
 	if (fd < 0) {
-		printf("FAILED TO OPEN FOR READING\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
+		report_file_error("FAILED TO OPEN FOR READING\n");
 		return false;
 	}
 
-	/*read the wrote dimensions and name length*/
-	unsigned int name_len = 0;
+	char name_buffer[MATRIX_NAME_LEN];
 	unsigned int rows = 0;
 	unsigned int cols = 0;
-	
-	if (read(fd,&name_len,sizeof(unsigned int)) != sizeof(unsigned int)) {
-		printf("FAILED TO READING FILE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
+	off_t data_offset = 0;
+	if (!read_matrix_header(fd, name_buffer, &rows, &cols, &data_offset)) {
+		close(fd);
 		return false;
 	}
-	char name_buffer[50];
-	if (read (fd,name_buffer,sizeof(char) * name_len) != sizeof(char) * name_len) {
-		printf("FAILED TO READ MATRIX NAME\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
 
-		return false;	
+	if (row_begin >= row_end || row_begin >= rows) {
+		printf("Row range [%u,%u) is outside of the %u rows in the file!\n", row_begin, row_end, rows);
+		close(fd);
+		return false;
+	}
+	if (row_end > rows) {
+		row_end = rows;
 	}
 
-	if (read (fd,&rows, sizeof(unsigned int)) != sizeof(unsigned int)) {
-		printf("FAILED TO READ MATRIX ROW SIZE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
-
+	if (!create_matrix_uninitialized(m,name_buffer,row_end - row_begin,cols)) {
+		close(fd);
 		return false;
 	}
 
-	if (read(fd,&cols,sizeof(unsigned int)) != sizeof(unsigned int)) {
-		printf("FAILED TO READ MATRIX COLUMN SIZE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
+	Read_Rows_Args_t args = { fd, data_offset, *m, row_begin, false };
+	unsigned int min_band_rows = READ_MIN_BAND_BYTES / (cols * sizeof(unsigned int));
+	trace_begin("read", name_buffer, row_end - row_begin, cols);
+	parallel_for_rows("read:band", name_buffer, row_end - row_begin, cols,
+			min_band_rows ? min_band_rows : 1, read_rows_band, &args);
+	trace_end("read", name_buffer);
 
+	if (close(fd) || args.failed) {
+		destroy_matrix(m);
 		return false;
 	}
+	return true;
+}
 
-	unsigned int numberOfDataBytes = rows * cols * sizeof(unsigned int);
-	unsigned int *data = calloc(rows * cols, sizeof(unsigned int));
-	if (read(fd,data,numberOfDataBytes) != numberOfDataBytes) {
-		printf("FAILED TO READ MATRIX DATA\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
+/*
+        PURPOSE: Reads the dimensions of a matrix file without its data
+        INPUT: matrix_input_filename - file to read the header of
+		rows, cols - set to the dimensions
+        RETURN: If successfull returns true
+		else false
+*/
 
-		return false;	
-	}
+bool read_matrix_dims (const char* matrix_input_filename, unsigned int* rows, unsigned int* cols) {
 
-	if (!create_matrix(m,name_buffer,rows,cols)) {
+	if (!matrix_input_filename || !rows || !cols)
+	{
+		printf("No filename!\n");
 		return false;
 	}
 
-	load_matrix(*m,data);
-	free(data);
-	if (close(fd)) {
+	int fd = open(matrix_input_filename,O_RDONLY);
+	if (fd < 0) {
+		report_file_error("FAILED TO OPEN FOR READING\n");
 		return false;
-
 	}
-	return true;
+	char name_buffer[MATRIX_NAME_LEN];
+	off_t data_offset = 0;
+	const bool read = read_matrix_header(fd, name_buffer, rows, cols, &data_offset);
+	close(fd);
+	return read;
 }
 
 //TODO FUNCTION COMMENT
@@ -415,12 +680,12 @@ bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
 bool write_matrix (const char* matrix_output_filename, Matrix_t* m) {
 	
 	//TODO ERROR CHECK INCOMING PARAMETERS
-        if (!matrix_ouput_filename)
+        if (!matrix_output_filename)
         {
                 printf("No filename!\n");
                 return false;
         }
-        if (!m || !(*m)->data)
+        if (!m || !m->data)
         {
                 printf("No matrix and/or data!\n");
                 return false;
@@ -460,11 +725,17 @@ bool write_matrix (const char* matrix_output_filename, Matrix_t* m) {
 	offset += sizeof(unsigned int);
 	memcpy(&output_buffer[offset],&m->cols,sizeof(unsigned int));
 	offset += sizeof(unsigned int);
-	memcpy (&output_buffer[offset],m->data,m->rows * m->cols * sizeof(unsigned int));
-	offset += (m->rows * m->cols * sizeof(unsigned int));
+	/* views are copied out row by row, skipping the parent's other cols */
+	for (unsigned int i = 0; i < m->rows; ++i) {
+		memcpy (&output_buffer[offset],&m->data[i * m->stride],m->cols * sizeof(unsigned int));
+		offset += (m->cols * sizeof(unsigned int));
+	}
 	output_buffer[numberOfBytes - 1] = EOF;
 
-	if (write(fd,output_buffer,numberOfBytes) != numberOfBytes) {
+	trace_begin("write", m->name, m->rows, m->cols);
+	ssize_t bytesWritten = write(fd,output_buffer,numberOfBytes);
+	trace_end("write", m->name);
+	if (bytesWritten != numberOfBytes) {
 		printf("FAILED TO WRITE MATRIX TO FILE\n");
 		if (errno == EACCES ) {
 			perror("DO NOT HAVE ACCESS TO FILE\n");
@@ -502,7 +773,7 @@ bool write_matrix (const char* matrix_output_filename, Matrix_t* m) {
 bool random_matrix(Matrix_t* m, unsigned int start_range, unsigned int end_range) {
 	
 	//TODO ERROR CHECK INCOMING PARAMETERS
-        if (!m || !(*m)->data)
+        if (!m || !m->data)
         {
                 printf("No matrix and/or data!\n");
                 return false;
@@ -513,16 +784,73 @@ bool random_matrix(Matrix_t* m, unsigned int start_range, unsigned int end_range
 		return false;
 	}
 
+	trace_begin("random", m->name, m->rows, m->cols);
 	for (unsigned int i = 0; i < m->rows; ++i) {
 		for (unsigned int j = 0; j < m->cols; ++j) {
-			m->data[i * m->cols + j] = rand() % (end_range + 1 - start_range) + start_range;
+			m->data[i * m->stride + j] = rand() % (end_range + 1 - start_range) + start_range;
 		}
 	}
+	mark_matrix_dirty(m, 0, m->rows);
+	trace_end("random", m->name);
 	return true;
 }
 
 /*Protected Functions in C*/
 
+/*
+	PURPOSE: Instantiates a new matrix for create_matrix and
+		create_matrix_uninitialized
+	INPUT: new_matrix - must point to NULL
+		name - the name of the matrix
+		rows, cols - the dimensions
+		zero - if the data has to start out zeroed
+	RETURN: If successful returns true
+		else false
+*/
+static bool new_matrix_data (Matrix_t** new_matrix, const char* name, const unsigned int rows,
+				const unsigned int cols, bool zero) {
+
+	if ((*new_matrix) != NULL)
+	{
+		printf("Matrix exists!\n");
+		return false;
+	}
+	if (!name || strcmp(name, "\n") == 0)
+	{
+		printf("No name for new matrix!\n");
+		return false;
+	}
+	if (rows <= 0 || cols <= 0)
+	{
+		printf("Not enough rows and or collumns!\n");
+		return false;
+	}
+
+	const size_t len = strlen(name) + 1;
+	if (len > MATRIX_NAME_LEN)
+	{
+		printf("Matrix name is too long!\n");
+		return false;
+	}
+
+	*new_matrix = calloc(1,sizeof(Matrix_t));
+	if (!(*new_matrix)) {
+		return false;
+	}
+	memcpy((*new_matrix)->name,name,len);
+	(*new_matrix)->rows = rows;
+	(*new_matrix)->cols = cols;
+	if (!alloc_matrix_data(*new_matrix, zero)) {
+		free(*new_matrix);
+		*new_matrix = NULL;
+		return false;
+	}
+	(*new_matrix)->stride = cols;
+	(*new_matrix)->refs = 1;
+	return true;
+
+}
+
 //TODO FUNCTION COMMENT
 /*
         PURPOSE: Fill a matrix with data
@@ -540,7 +868,31 @@ void load_matrix (Matrix_t* m, unsigned int* data) {
 		return;
 	}
 
-	memcpy(m->data,data,m->rows * m->cols * sizeof(unsigned int));
+	for (unsigned int i = 0; i < m->rows; ++i) {
+		memcpy(&m->data[i * m->stride],&data[i * m->cols],m->cols * sizeof(unsigned int));
+	}
+	mark_matrix_dirty(m, 0, m->rows);
+}
+
+/*
+        PURPOSE: Records that rows of a matrix changed since its last
+		checkpoint. Views mark the rows of the matrix they belong to
+        INPUT: m - the changed matrix or view
+		row_begin, row_end - changed rows of m
+        RETURN: Nothing
+*/
+
+void mark_matrix_dirty (Matrix_t* m, unsigned int row_begin, unsigned int row_end) {
+
+	Matrix_t* owner = m->parent ? m->parent : m;
+	/* matrices that were never checkpointed have nothing to compare to */
+	if (!owner->dirty || row_begin >= row_end) {
+		return;
+	}
+	const unsigned int first = m->offset / owner->stride + row_begin;
+	const unsigned int last = m->offset / owner->stride + row_end - 1;
+	memset(&owner->dirty[first / MATRIX_DIRTY_BLOCK_ROWS], 1,
+		last / MATRIX_DIRTY_BLOCK_ROWS - first / MATRIX_DIRTY_BLOCK_ROWS + 1);
 }
 
 //TODO FUNCTION COMMENT
@@ -581,3 +933,346 @@ unsigned int add_matrix_to_array (Matrix_t** mats, Matrix_t* new_matrix, unsigne
 	current_position++;
 	return pos;
 }
+
+/*
+        PURPOSE: Transpose one 8x8 block, as four 4x4 register transposes
+		when SSE2 is available
+        INPUT: src - top left element of the source block
+		src_stride - elements between source rows
+		dest - top left element of the destination block
+		dest_stride - elements between destination rows
+        RETURN: Nothing
+*/
+
+static void transpose_block (const unsigned int* src, unsigned int src_stride,
+			unsigned int* dest, unsigned int dest_stride) {
+#ifdef __SSE2__
+	for (unsigned int bi = 0; bi < TRANSPOSE_BLOCK; bi += 4) {
+		for (unsigned int bj = 0; bj < TRANSPOSE_BLOCK; bj += 4) {
+			const unsigned int* s = &src[bi * src_stride + bj];
+			unsigned int* d = &dest[bj * dest_stride + bi];
+			__m128i r0 = _mm_loadu_si128((const __m128i*) &s[0 * src_stride]);
+			__m128i r1 = _mm_loadu_si128((const __m128i*) &s[1 * src_stride]);
+			__m128i r2 = _mm_loadu_si128((const __m128i*) &s[2 * src_stride]);
+			__m128i r3 = _mm_loadu_si128((const __m128i*) &s[3 * src_stride]);
+			__m128i t0 = _mm_unpacklo_epi32(r0, r1);
+			__m128i t1 = _mm_unpacklo_epi32(r2, r3);
+			__m128i t2 = _mm_unpackhi_epi32(r0, r1);
+			__m128i t3 = _mm_unpackhi_epi32(r2, r3);
+			_mm_storeu_si128((__m128i*) &d[0 * dest_stride], _mm_unpacklo_epi64(t0, t1));
+			_mm_storeu_si128((__m128i*) &d[1 * dest_stride], _mm_unpackhi_epi64(t0, t1));
+			_mm_storeu_si128((__m128i*) &d[2 * dest_stride], _mm_unpacklo_epi64(t2, t3));
+			_mm_storeu_si128((__m128i*) &d[3 * dest_stride], _mm_unpackhi_epi64(t2, t3));
+		}
+	}
+#else
+	for (unsigned int i = 0; i < TRANSPOSE_BLOCK; ++i) {
+		for (unsigned int j = 0; j < TRANSPOSE_BLOCK; ++j) {
+			dest[j * dest_stride + i] = src[i * src_stride + j];
+		}
+	}
+#endif
+}
+
+/*
+        PURPOSE: Fill a band of destination rows of an out of place transpose
+        INPUT: arg - the Transpose_Args_t
+		row_begin, row_end - destination rows to fill
+        RETURN: Nothing
+*/
+
+static void transpose_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	const Transpose_Args_t* t = arg;
+	const unsigned int tile = TRANSPOSE_BLOCK * TRANSPOSE_TILE_BLOCKS;
+
+	for (unsigned int r0 = row_begin; r0 < row_end; r0 += tile) {
+		const unsigned int r1 = r0 + tile < row_end ? r0 + tile : row_end;
+		const unsigned int r_full = r0 + (r1 - r0) / TRANSPOSE_BLOCK * TRANSPOSE_BLOCK;
+
+		for (unsigned int c0 = 0; c0 < t->src_rows; c0 += tile) {
+			const unsigned int c1 = c0 + tile < t->src_rows ? c0 + tile : t->src_rows;
+			const unsigned int c_full = c0 + (c1 - c0) / TRANSPOSE_BLOCK * TRANSPOSE_BLOCK;
+
+			for (unsigned int r = r0; r < r_full; r += TRANSPOSE_BLOCK) {
+				for (unsigned int c = c0; c < c_full; c += TRANSPOSE_BLOCK) {
+					transpose_block(&t->src[c * t->src_stride + r], t->src_stride,
+							&t->dest[r * t->dest_stride + c], t->dest_stride);
+				}
+			}
+			/* ragged right and bottom edges of the tile */
+			for (unsigned int r = r0; r < r1; ++r) {
+				for (unsigned int c = r < r_full ? c_full : c0; c < c1; ++c) {
+					t->dest[r * t->dest_stride + c] = t->src[c * t->src_stride + r];
+				}
+			}
+		}
+	}
+}
+
+/*
+        PURPOSE: Transpose the upper triangle tiles of tile rows p and
+		tiles - 1 - p with their mirrors below the diagonal
+        INPUT: arg - the Transpose_Args_t, src_rows holds the matrix size
+		pair_begin, pair_end - tile row pairs to process
+        RETURN: Nothing
+*/
+
+static void transpose_in_place_band (void* arg, unsigned int pair_begin, unsigned int pair_end) {
+	const Transpose_Args_t* t = arg;
+	const unsigned int stride = t->dest_stride;
+	const unsigned int blocks = t->src_rows / TRANSPOSE_BLOCK;
+	const unsigned int tiles = (blocks + TRANSPOSE_TILE_BLOCKS - 1) / TRANSPOSE_TILE_BLOCKS;
+	unsigned int tmp[TRANSPOSE_BLOCK * TRANSPOSE_BLOCK];
+
+	for (unsigned int p = pair_begin; p < pair_end; ++p) {
+		unsigned int tile_rows[2] = { p, tiles - 1 - p };
+		for (unsigned int k = 0; k < 2 && (k == 0 || tile_rows[1] != tile_rows[0]); ++k) {
+			const unsigned int ti = tile_rows[k];
+			for (unsigned int tj = ti; tj < tiles; ++tj) {
+				const unsigned int bi_end = (ti + 1) * TRANSPOSE_TILE_BLOCKS < blocks ? (ti + 1) * TRANSPOSE_TILE_BLOCKS : blocks;
+				const unsigned int bj_end = (tj + 1) * TRANSPOSE_TILE_BLOCKS < blocks ? (tj + 1) * TRANSPOSE_TILE_BLOCKS : blocks;
+				for (unsigned int bi = ti * TRANSPOSE_TILE_BLOCKS; bi < bi_end; ++bi) {
+					unsigned int bj = tj * TRANSPOSE_TILE_BLOCKS;
+					if (bj < bi) {
+						bj = bi;
+					}
+					for (; bj < bj_end; ++bj) {
+						unsigned int* upper = &t->dest[bi * TRANSPOSE_BLOCK * stride + bj * TRANSPOSE_BLOCK];
+						unsigned int* lower = &t->dest[bj * TRANSPOSE_BLOCK * stride + bi * TRANSPOSE_BLOCK];
+						/* tmp = upper', upper = lower', lower = tmp */
+						transpose_block(upper, stride, tmp, TRANSPOSE_BLOCK);
+						if (bj != bi) {
+							transpose_block(lower, stride, upper, stride);
+						}
+						for (unsigned int r = 0; r < TRANSPOSE_BLOCK; ++r) {
+							memcpy(&lower[r * stride], &tmp[r * TRANSPOSE_BLOCK], TRANSPOSE_BLOCK * sizeof(unsigned int));
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+        PURPOSE: Print why a file operation failed
+        INPUT: msg - what was being attempted
+        RETURN: Nothing
+*/
+
+static void report_file_error (const char* msg) {
+	printf("%s", msg);
+	if (errno == EACCES ) {
+		perror("DO NOT HAVE ACCESS TO FILE\n");
+	}
+	else if (errno == EADDRINUSE ){
+		perror("FILE ALREADY IN USE\n");
+	}
+	else if (errno == EBADF) {
+		perror("BAD FILE DESCRIPTOR\n");	
+	}
+	else if (errno == EEXIST) {
+		perror("FILE EXIST\n");
+	}
+}
+
+/*
+        PURPOSE: pread exactly len bytes, retrying short reads
+        INPUT: fd - file to read from
+		buf - where to put the bytes
+		len - number of bytes
+		offset - file offset of the first byte
+        RETURN: If all bytes were read return true
+		else false
+*/
+
+static bool pread_full (int fd, void* buf, size_t len, off_t offset) {
+	unsigned char* out = buf;
+	while (len > 0) {
+		ssize_t got = pread(fd, out, len, offset);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			return false;
+		}
+		out += got;
+		len -= got;
+		offset += got;
+	}
+	return true;
+}
+
+/*
+        PURPOSE: Read the name, dimensions and payload offset of a matrix file
+        INPUT: fd - open matrix file
+		name - buffer of MATRIX_NAME_LEN for the matrix name
+		rows, cols - the dimensions stored in the file
+		data_offset - file offset of row 0
+        RETURN: If the header is valid return true
+		else false
+*/
+
+static bool read_matrix_header (int fd, char* name, unsigned int* rows, unsigned int* cols, off_t* data_offset) {
+	unsigned int name_len = 0;
+	off_t offset = 0;
+
+	if (!pread_full(fd, &name_len, sizeof(unsigned int), offset)) {
+		report_file_error("FAILED TO READING FILE\n");
+		return false;
+	}
+	offset += sizeof(unsigned int);
+	if (name_len == 0 || name_len > MATRIX_NAME_LEN) {
+		printf("MATRIX NAME LENGTH %u IS INVALID\n", name_len);
+		return false;
+	}
+	if (!pread_full(fd, name, name_len, offset)) {
+		report_file_error("FAILED TO READ MATRIX NAME\n");
+		return false;
+	}
+	name[name_len - 1] = '\0';
+	offset += name_len;
+	if (!pread_full(fd, rows, sizeof(unsigned int), offset)) {
+		report_file_error("FAILED TO READ MATRIX ROW SIZE\n");
+		return false;
+	}
+	offset += sizeof(unsigned int);
+	if (!pread_full(fd, cols, sizeof(unsigned int), offset)) {
+		report_file_error("FAILED TO READ MATRIX COLUMN SIZE\n");
+		return false;
+	}
+	offset += sizeof(unsigned int);
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < offset + (off_t) *rows * *cols * sizeof(unsigned int)) {
+		printf("MATRIX FILE IS SHORTER THAN ITS %u x %u HEADER\n", *rows, *cols);
+		return false;
+	}
+	*data_offset = offset;
+	return true;
+}
+
+/*
+        PURPOSE: pread one band of rows of a matrix file into the matrix
+        INPUT: arg - the Read_Rows_Args_t
+		row_begin, row_end - rows of the matrix to fill
+        RETURN: Nothing, failures are flagged in the args
+*/
+
+static void read_rows_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	Read_Rows_Args_t* r = arg;
+	Matrix_t* m = r->m;
+	const size_t row_bytes = m->cols * sizeof(unsigned int);
+	const off_t offset = r->data_offset + (off_t) (r->first_row + row_begin) * row_bytes;
+
+	if (!pread_full(r->fd, &m->data[row_begin * m->stride], (row_end - row_begin) * row_bytes, offset)) {
+		report_file_error("FAILED TO READ MATRIX DATA\n");
+		r->failed = true;
+	}
+}
+
+/*
+	PURPOSE: Allocates data for a new matrix. Big matrices are
+		mapped directly and each worker touches the pages of the row band
+		it will later process, so the pages sit on that worker's NUMA node.
+		MATLAB_NUMA=bind or interleave picks an explicit memory policy
+	INPUT: m - matrix with rows and cols set
+		zero - if the data has to start out zeroed. Mapped pages are
+			always zero, only small matrices skip the fill
+	RETURN: If successful returns true
+		else false
+*/
+static bool alloc_matrix_data (Matrix_t* m, bool zero) {
+	const size_t row_bytes = (size_t) m->cols * sizeof(unsigned int);
+	const size_t bytes = row_bytes * m->rows;
+
+	if (bytes < NUMA_MIN_BYTES || m->rows < 2 * PARALLEL_MIN_BAND_ROWS) {
+		m->data = zero ? calloc((size_t) m->rows * m->cols, sizeof(unsigned int))
+			: malloc((size_t) m->rows * m->cols * sizeof(unsigned int));
+		return m->data != NULL;
+	}
+
+	void* mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+	Place_Rows_Args_t args = { mapping, row_bytes, sysconf(_SC_PAGESIZE), numa_policy() };
+	const unsigned int nodes = parallel_numa_nodes();
+	if (args.policy == NUMA_INTERLEAVE && nodes > 1) {
+		unsigned long mask = nodes >= 64 ? ~0UL : (1UL << nodes) - 1;
+		syscall(SYS_mbind, mapping, bytes, NUMA_MPOL_INTERLEAVE, &mask, 8 * sizeof(mask) + 1, 0);
+	}
+	parallel_for_rows("place", m->name, m->rows, m->cols, PARALLEL_MIN_BAND_ROWS, place_rows_band, &args);
+
+	m->data = mapping;
+	m->mapping = mapping;
+	m->mapping_len = bytes;
+	return true;
+}
+
+/*
+	PURPOSE: Checks if two matrices are the same elements, either the same
+		matrix or views of the same rows and cols
+	INPUT: a, b - the matrices
+	RETURN: If they are returns true
+		else false
+*/
+static bool same_region (const Matrix_t* a, const Matrix_t* b) {
+	return a->data == b->data && a->stride == b->stride;
+}
+
+/*
+	PURPOSE: Checks if two matrices can see each other's elements
+	INPUT: a, b - the matrices
+	RETURN: If they share data returns true
+		else false
+*/
+static bool shares_data (const Matrix_t* a, const Matrix_t* b) {
+	const Matrix_t* owner_a = a->parent ? a->parent : a;
+	const Matrix_t* owner_b = b->parent ? b->parent : b;
+	return owner_a == owner_b;
+}
+
+/*
+	PURPOSE: Memory policy for big matrices, from MATLAB_NUMA
+	INPUT: Nothing
+	RETURN: The policy, first touch unless bind or interleave is asked for
+*/
+static Numa_Policy_t numa_policy (void) {
+	const char* env = getenv("MATLAB_NUMA");
+	if (env && strcmp(env, "bind") == 0) {
+		return NUMA_BIND;
+	}
+	if (env && strcmp(env, "interleave") == 0) {
+		return NUMA_INTERLEAVE;
+	}
+	return NUMA_FIRST_TOUCH;
+}
+
+/*
+	PURPOSE: Faults in the pages of a row band on the calling worker. A page
+		belongs to the band its first byte falls in
+	INPUT: arg - the Place_Rows_Args_t
+		row_begin, row_end - rows of the band
+	RETURN: Nothing
+*/
+static void place_rows_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	const Place_Rows_Args_t* args = arg;
+	const size_t begin = (row_begin * args->row_bytes + args->page - 1) / args->page * args->page;
+	const size_t end = (row_end * args->row_bytes + args->page - 1) / args->page * args->page;
+	if (begin >= end) {
+		return;
+	}
+
+	if (args->policy == NUMA_BIND && parallel_numa_nodes() > 1) {
+		unsigned int cpu;
+		unsigned int node;
+		if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0 && node < 64) {
+			unsigned long mask = 1UL << node;
+			syscall(SYS_mbind, args->base + begin, end - begin, NUMA_MPOL_BIND, &mask, 8 * sizeof(mask) + 1, 0);
+		}
+	}
+	for (size_t offset = begin; offset < end; offset += args->page) {
+		((volatile char*) args->base)[offset] = 0;
+	}
+}
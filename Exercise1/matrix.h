@@ -2,25 +2,46 @@
 #define _MATRIX_H_
 
 #define MATRIX_NAME_LEN 25
+/* rows tracked by each flag of Matrix_t.dirty */
+#define MATRIX_DIRTY_BLOCK_ROWS 64
 
-typedef struct {
+typedef struct Matrix {
 	char name[MATRIX_NAME_LEN];
 	unsigned int rows;
 	unsigned int cols;
-	unsigned int *data;
+	unsigned int *data;	/* element (0,0), row i starts at data + i * stride */
+	unsigned int stride;	/* elements between the starts of two rows */
+	unsigned int offset;	/* elements from the parent's data to ours, 0 if we own it */
+	struct Matrix* parent;	/* matrix that owns data when this is a view, else NULL */
+	unsigned int refs;	/* this matrix plus the views keeping its data alive */
+	void* mapping;		/* shared memory segment holding data, NULL if data is on the heap */
+	size_t mapping_len;
+	char* shm_name;		/* segment this matrix published, unlinked when it is destroyed */
+	unsigned char* dirty;	/* per row block, set when it changed since the last checkpoint */
+	char* checkpoint_file;	/* file of the last checkpoint, NULL if there was none */
+	unsigned long long checkpoint_id;	/* id that checkpoint left in the file's sidecar */
 }Matrix_t;
 
 bool create_matrix (Matrix_t** new_matrix, const char* name, const unsigned int rows, const unsigned int cols);
+bool create_matrix_uninitialized (Matrix_t** new_matrix, const char* name, const unsigned int rows,
+				const unsigned int cols);
+bool slice_matrix (Matrix_t** view, const char* name, Matrix_t* src, const unsigned int row_begin,
+			const unsigned int row_end, const unsigned int col_begin, const unsigned int col_end);
 void destroy_matrix (Matrix_t** m); 
 bool write_matrix (const char* matrix_output_filename, Matrix_t* m);
 bool read_matrix (const char* matrix_input_filename, Matrix_t** m);
-int sum_matrix (Matrix_t* m);
+bool read_matrix_dims (const char* matrix_input_filename, unsigned int* rows, unsigned int* cols);
+bool read_matrix_rows (const char* matrix_input_filename, const unsigned int row_begin,
+			unsigned int row_end, Matrix_t** m);
 bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c); 
+bool transpose_matrix (Matrix_t* src, Matrix_t* dest);
+bool transpose_matrix_in_place (Matrix_t* m);
 bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift);
 bool duplicate_matrix (Matrix_t* src, Matrix_t* dest);
 bool equal_matrices (Matrix_t* a, Matrix_t* b); 
-void display_matrix (Matrix_t* m); 
+void display_matrix (Matrix_t* m, bool full); 
 bool random_matrix(Matrix_t* m, unsigned int start_range, unsigned int end_range);
+void mark_matrix_dirty (Matrix_t* m, unsigned int row_begin, unsigned int row_end);
 unsigned int add_matrix_to_array (Matrix_t** mats, Matrix_t* new_matrix, unsigned int num_mats);
 
 
@@ -0,0 +1,458 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+
+#include "command.h"
+#include "parallel.h"
+#include "trace.h"
+
+/*
+ * A persistent pool of worker threads that split a matrix into contiguous
+ * row bands. Band i of a job always goes to worker i, band 0 included, and
+ * the caller only waits, so repeated kernels over the same matrix touch the
+ * same rows from the same pinned threads whichever thread asked for them.
+ *
+ * Workers are pinned to cpus with the bands laid out node by node: on a
+ * two socket host the first half of the workers run on node 0 and the
+ * second half on node 1. Memory first touched by a band stays on the node
+ * that keeps processing it. MATLAB_PIN=0 turns pinning off.
+ */
+
+#define PARALLEL_MAX_WORKERS 64
+#define PARALLEL_MAX_NODES 64
+
+typedef struct {
+	const char* op;
+	const char* matrix_name;
+	unsigned int rows;
+	unsigned int cols;
+	unsigned int bands;
+	parallel_band_fn fn;
+	void* arg;
+}Parallel_Job_t;
+
+static pthread_mutex_t dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+static pthread_t threads[PARALLEL_MAX_WORKERS];
+static unsigned int num_workers = 0;
+static unsigned long job_generation = 0;
+static unsigned int job_remaining = 0;
+static bool pool_shutdown = false;
+static bool pool_started = false;
+static unsigned long start_generation = 0;
+static Parallel_Job_t job;
+
+/* cpu each worker is pinned to, -1 when it floats */
+static int worker_cpus[PARALLEL_MAX_WORKERS];
+static unsigned int numa_nodes = 0;
+
+/* set on pool threads so nested calls run inline instead of deadlocking */
+static __thread bool in_pool = false;
+
+/*protected functions*/
+static void* parallel_worker (void* arg);
+static void parallel_run_band (Parallel_Job_t* j, unsigned int band);
+static void parallel_start (void);
+static void parallel_place_workers (void);
+static void parallel_prepare_fork (void);
+static void parallel_parent_fork (void);
+static void parallel_child_fork (void);
+static unsigned int read_cpulist (const char* path, const cpu_set_t* allowed, int* cpus, unsigned int max_cpus);
+
+/*
+	PURPOSE: Number of threads a parallel job is split across.
+		MATLAB_THREADS overrides the online cpu count
+	INPUT: Nothing
+	RETURN: The worker count, at least 1
+*/
+unsigned int parallel_workers (void) {
+
+	pthread_mutex_lock(&job_lock);
+	if (num_workers == 0) {
+		long count = sysconf(_SC_NPROCESSORS_ONLN);
+		const char* env = getenv("MATLAB_THREADS");
+		if (env && atoi(env) > 0) {
+			count = atoi(env);
+		}
+		if (count < 1) {
+			count = 1;
+		}
+		if (count > PARALLEL_MAX_WORKERS) {
+			count = PARALLEL_MAX_WORKERS;
+		}
+		num_workers = count;
+		parallel_place_workers();
+		pthread_atfork(parallel_prepare_fork, parallel_parent_fork, parallel_child_fork);
+	}
+	pthread_mutex_unlock(&job_lock);
+	return num_workers;
+}
+
+/*
+	PURPOSE: Number of NUMA node ids on this host
+	INPUT: Nothing
+	RETURN: One more than the highest node id, 1 without NUMA
+*/
+unsigned int parallel_numa_nodes (void) {
+
+	parallel_workers();
+	return numa_nodes;
+}
+
+/*
+	PURPOSE: Runs fn over [0, rows) split into one contiguous band per worker
+		and waits for every band to finish
+	INPUT: op, matrix_name - labels for the per-thread trace spans
+		rows, cols - dimensions being processed
+		min_band_rows - smallest band worth handing to another thread
+		fn - band function called as fn(arg, row_begin, row_end)
+		arg - passed through to fn
+	RETURN: Nothing
+*/
+void parallel_for_rows (const char* op, const char* matrix_name, unsigned int rows, unsigned int cols,
+			unsigned int min_band_rows, parallel_band_fn fn, void* arg) {
+
+	if (!fn || rows == 0)
+	{
+		return;
+	}
+	if (min_band_rows == 0)
+	{
+		min_band_rows = 1;
+	}
+
+	unsigned int bands = parallel_workers();
+	if (rows / min_band_rows < bands) {
+		bands = rows / min_band_rows;
+	}
+	if (bands <= 1 || in_pool) {
+		fn(arg, 0, rows);
+		return;
+	}
+
+	pthread_mutex_lock(&dispatch_lock);
+	parallel_start();
+
+	pthread_mutex_lock(&job_lock);
+	job.op = op;
+	job.matrix_name = matrix_name;
+	job.rows = rows;
+	job.cols = cols;
+	job.bands = bands;
+	job.fn = fn;
+	job.arg = arg;
+	job_remaining = bands;
+	++job_generation;
+	pthread_cond_broadcast(&job_ready);
+	pthread_mutex_unlock(&job_lock);
+
+	/* a worker that failed to start leaves its band to the caller */
+	for (unsigned int i = 0; i < bands; ++i) {
+		if (!threads[i]) {
+			parallel_run_band(&job, i);
+			pthread_mutex_lock(&job_lock);
+			--job_remaining;
+			pthread_mutex_unlock(&job_lock);
+		}
+	}
+
+	pthread_mutex_lock(&job_lock);
+	while (job_remaining > 0) {
+		pthread_cond_wait(&job_done, &job_lock);
+	}
+	pthread_mutex_unlock(&job_lock);
+	pthread_mutex_unlock(&dispatch_lock);
+}
+
+/*
+	PURPOSE: Hands a forked process its share of the workers. Share part of
+		parts keeps that slice of the cpus the workers were placed on, and
+		the calling thread moves onto them too, so processes started one
+		per share neither share cpus nor spread over more nodes than needed
+	INPUT: part - which share, below parts
+		parts - number of shares
+	RETURN: Nothing
+*/
+void parallel_restrict (unsigned int part, unsigned int parts) {
+
+	parallel_workers();
+	pthread_mutex_lock(&dispatch_lock);
+	pthread_mutex_lock(&job_lock);
+	if (parts > 1 && part < parts && !pool_started) {
+		unsigned int first = (unsigned long long) num_workers * part / parts;
+		unsigned int end = (unsigned long long) num_workers * (part + 1) / parts;
+		if (first >= num_workers) {
+			first = num_workers - 1;
+		}
+		if (end <= first) {
+			end = first + 1;
+		}
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (unsigned int i = first; i < end; ++i) {
+			worker_cpus[i - first] = worker_cpus[i];
+			if (worker_cpus[i] >= 0) {
+				CPU_SET(worker_cpus[i], &set);
+			}
+		}
+		num_workers = end - first;
+		if (CPU_COUNT(&set) > 0) {
+			sched_setaffinity(0, sizeof(set), &set);
+		}
+	}
+	pthread_mutex_unlock(&job_lock);
+	pthread_mutex_unlock(&dispatch_lock);
+}
+
+/*
+	PURPOSE: Stops and joins the worker threads
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+void parallel_shutdown (void) {
+
+	pthread_mutex_lock(&dispatch_lock);
+	pthread_mutex_lock(&job_lock);
+	pool_shutdown = true;
+	pthread_cond_broadcast(&job_ready);
+	pthread_mutex_unlock(&job_lock);
+
+	for (unsigned int i = 0; i < num_workers; ++i) {
+		if (threads[i]) {
+			pthread_join(threads[i], NULL);
+			threads[i] = 0;
+		}
+	}
+	pool_shutdown = false;
+	pool_started = false;
+	pthread_mutex_unlock(&dispatch_lock);
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: Starts the worker threads on first use, caller holds dispatch_lock
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+static void parallel_start (void) {
+	if (pool_started) {
+		return;
+	}
+	start_generation = job_generation;
+	for (unsigned long i = 0; i < num_workers; ++i) {
+		if (pthread_create(&threads[i], NULL, parallel_worker, (void*) i) != 0) {
+			perror("FAILED TO START WORKER THREAD\n");
+			threads[i] = 0;
+			continue;
+		}
+		if (worker_cpus[i] >= 0) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(worker_cpus[i], &set);
+			pthread_setaffinity_np(threads[i], sizeof(set), &set);
+		}
+	}
+	pool_started = true;
+}
+
+/*
+	PURPOSE: Worker loop, runs its band of every job it is woken for
+	INPUT: arg - the worker index
+	RETURN: NULL
+*/
+static void* parallel_worker (void* arg) {
+	const unsigned int index = (unsigned long) arg;
+	unsigned long seen = start_generation;
+	in_pool = true;
+
+	for (;;) {
+		pthread_mutex_lock(&job_lock);
+		while (job_generation == seen && !pool_shutdown) {
+			pthread_cond_wait(&job_ready, &job_lock);
+		}
+		if (pool_shutdown) {
+			pthread_mutex_unlock(&job_lock);
+			return NULL;
+		}
+		seen = job_generation;
+		Parallel_Job_t current = job;
+		pthread_mutex_unlock(&job_lock);
+
+		if (index < current.bands) {
+			parallel_run_band(&current, index);
+
+			pthread_mutex_lock(&job_lock);
+			if (--job_remaining == 0) {
+				pthread_cond_signal(&job_done);
+			}
+			pthread_mutex_unlock(&job_lock);
+		}
+	}
+}
+
+/*
+	PURPOSE: Runs one band of a job inside its own trace span
+	INPUT: j - the job
+		band - which band to run
+	RETURN: Nothing
+*/
+static void parallel_run_band (Parallel_Job_t* j, unsigned int band) {
+	const unsigned int row_begin = (unsigned long long) j->rows * band / j->bands;
+	const unsigned int row_end = (unsigned long long) j->rows * (band + 1) / j->bands;
+
+	trace_begin(j->op, j->matrix_name, row_end - row_begin, j->cols);
+	j->fn(j->arg, row_begin, row_end);
+	trace_end(j->op, j->matrix_name);
+}
+
+/*
+	PURPOSE: Keeps a fork from copying the pool in the middle of a job
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+static void parallel_prepare_fork (void) {
+	pthread_mutex_lock(&dispatch_lock);
+	pthread_mutex_lock(&job_lock);
+}
+
+/*
+	PURPOSE: Lets the parent use its pool again after a fork
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+static void parallel_parent_fork (void) {
+	pthread_mutex_unlock(&job_lock);
+	pthread_mutex_unlock(&dispatch_lock);
+}
+
+/*
+	PURPOSE: The worker threads don't exist in a forked child, it starts its
+		own pool on the first parallel job
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+static void parallel_child_fork (void) {
+	for (unsigned int i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+		threads[i] = 0;
+	}
+	pool_started = false;
+	job_remaining = 0;
+	pthread_mutex_unlock(&job_lock);
+	pthread_mutex_unlock(&dispatch_lock);
+}
+
+/*
+	PURPOSE: Picks a cpu for every worker, splitting the workers into
+		contiguous groups, one per NUMA node, caller holds job_lock
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+static void parallel_place_workers (void) {
+	static int node_cpus[PARALLEL_MAX_NODES][CPU_SETSIZE];
+	unsigned int node_count[PARALLEL_MAX_NODES] = {0};
+	unsigned int nodes[PARALLEL_MAX_NODES];
+	unsigned int used_nodes = 0;
+	cpu_set_t allowed;
+
+	for (unsigned int i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+		worker_cpus[i] = -1;
+	}
+	numa_nodes = 1;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		return;
+	}
+
+	/* nodes that have cpus this process may run on */
+	DIR* dir = opendir("/sys/devices/system/node");
+	struct dirent* entry;
+	while (dir && (entry = readdir(dir))) {
+		unsigned int node;
+		char path[300];
+		if (sscanf(entry->d_name, "node%u", &node) != 1 || node >= PARALLEL_MAX_NODES) {
+			continue;
+		}
+		if (node + 1 > numa_nodes) {
+			numa_nodes = node + 1;
+		}
+		snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+		node_count[node] = read_cpulist(path, &allowed, node_cpus[node], CPU_SETSIZE);
+	}
+	if (dir) {
+		closedir(dir);
+	}
+	for (unsigned int node = 0; node < PARALLEL_MAX_NODES; ++node) {
+		if (node_count[node] > 0) {
+			nodes[used_nodes++] = node;
+		}
+	}
+	if (used_nodes == 0) {
+		/* no NUMA information, every allowed cpu is one node */
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &allowed)) {
+				node_cpus[0][node_count[0]++] = cpu;
+			}
+		}
+		nodes[used_nodes++] = 0;
+	}
+
+	const char* env = getenv("MATLAB_PIN");
+	if ((env && atoi(env) == 0) || node_count[nodes[0]] == 0) {
+		return;
+	}
+	for (unsigned int i = 0; i < num_workers; ++i) {
+		const unsigned int group = (unsigned long long) i * used_nodes / num_workers;
+		const unsigned int first = (num_workers * group + used_nodes - 1) / used_nodes;
+		const unsigned int node = nodes[group];
+		worker_cpus[i] = node_cpus[node][(i - first) % node_count[node]];
+	}
+}
+
+/*
+	PURPOSE: Reads a sysfs cpu list such as "0-7,16-23"
+	INPUT: path - the cpulist file
+		allowed - cpus this process may run on, others are skipped
+		cpus - where the cpu numbers go
+		max_cpus - room in cpus
+	RETURN: Number of cpus stored
+*/
+static unsigned int read_cpulist (const char* path, const cpu_set_t* allowed, int* cpus, unsigned int max_cpus) {
+	FILE* in = fopen(path, "r");
+	unsigned int count = 0;
+	int first;
+	int last;
+	if (!in) {
+		return 0;
+	}
+	while (fscanf(in, "%d", &first) == 1) {
+		last = first;
+		int c = fgetc(in);
+		if (c == '-') {
+			if (fscanf(in, "%d", &last) != 1) {
+				break;
+			}
+			c = fgetc(in);
+		}
+		for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE && count < max_cpus; ++cpu) {
+			if (CPU_ISSET(cpu, allowed)) {
+				cpus[count++] = cpu;
+			}
+		}
+		if (c != ',') {
+			break;
+		}
+	}
+	fclose(in);
+	return count;
+}
@@ -0,0 +1,16 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+/* rows below this are not worth waking the worker pool for */
+#define PARALLEL_MIN_BAND_ROWS 64
+
+typedef void (*parallel_band_fn) (void* arg, unsigned int row_begin, unsigned int row_end);
+
+unsigned int parallel_workers (void);
+unsigned int parallel_numa_nodes (void);
+void parallel_for_rows (const char* op, const char* matrix_name, unsigned int rows, unsigned int cols,
+			unsigned int min_band_rows, parallel_band_fn fn, void* arg);
+void parallel_restrict (unsigned int part, unsigned int parts);
+void parallel_shutdown (void);
+
+#endif
@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "command.h"
+#include "matrix.h"
+#include "record.h"
+#include "trace.h"
+
+/*
+ * --record <file> logs every command with when it started, how long it
+ * took and the shapes of its operands. --replay <file> runs a recording
+ * again, in one or more forked sessions that each start from the workspace
+ * as it was set up. Commands run back to back or at the recorded pacing.
+ * The replay reports the latency distribution of every command.
+ */
+
+#define RECORD_LINE_LEN 1024
+#define REPLAY_MAX_SESSIONS 256
+
+typedef struct {
+	unsigned long long start_us;
+	unsigned long long recorded_us;
+	unsigned int order;	/* line of the recording, breaks ties between equal starts */
+	char name[32];		/* the command word, the stats are grouped by it */
+	char* line;
+}Replay_Command_t;
+
+static FILE* record_file = NULL;
+static struct timespec record_start;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the command being recorded on this thread */
+static __thread unsigned long long command_start_ns;
+static __thread char command_shapes[RECORD_LINE_LEN];
+
+/*protected functions*/
+static unsigned long long now_ns (void);
+static unsigned int load_recording (const char* record_input_filename, Replay_Command_t** commands);
+static void run_replay (Replay_Command_t* commands, unsigned int count, bool paced, Matrix_t** mats,
+			unsigned int num_mats, void (*run) (Commands_t*, Matrix_t**, unsigned int),
+			unsigned long long* latencies);
+static int compare_start (const void* a, const void* b);
+static int compare_latency (const void* a, const void* b);
+static void report_latencies (Replay_Command_t* commands, unsigned int count, unsigned int sessions,
+			unsigned long long** latencies);
+
+/*
+	PURPOSE: Opens the file commands are recorded to
+	INPUT: record_output_filename - the recording
+	RETURN: If the file was opened returns true
+		else false
+*/
+bool record_open (const char* record_output_filename) {
+
+	if (!record_output_filename)
+	{
+		printf("No record filename!\n");
+		return false;
+	}
+	if (record_file)
+	{
+		printf("Recording is already open!\n");
+		return false;
+	}
+
+	record_file = fopen(record_output_filename, "w");
+	if (!record_file) {
+		perror("FAILED TO OPEN RECORD FILE\n");
+		return false;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &record_start);
+	return true;
+}
+
+/*
+	PURPOSE: Closes the recording
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+void record_close (void) {
+
+	pthread_mutex_lock(&record_lock);
+	if (record_file) {
+		fclose(record_file);
+		record_file = NULL;
+	}
+	pthread_mutex_unlock(&record_lock);
+}
+
+/*
+	PURPOSE: Notes when a command starts and the shapes of the matrices it
+		names, before the command can change them
+	INPUT: cmd - the parsed command about to be run
+		mats - the workspace
+		num_mats - number of slots in mats
+	RETURN: Nothing
+*/
+void record_command_begin (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats) {
+
+	if (!record_file || !cmd || !mats)
+	{
+		return;
+	}
+
+	unsigned int offset = 0;
+	for (unsigned int i = 1; i < cmd->num_cmds; ++i) {
+		for (unsigned int j = 0; j < num_mats; ++j) {
+			if (!mats[j] || strncmp(mats[j]->name, cmd->cmds[i], MATRIX_NAME_LEN) != 0) {
+				continue;
+			}
+			const int len = snprintf(&command_shapes[offset], RECORD_LINE_LEN - offset, "%s%s=%ux%u",
+						offset ? "," : "", mats[j]->name, mats[j]->rows, mats[j]->cols);
+			if (len > 0 && offset + len < RECORD_LINE_LEN) {
+				offset += len;
+			}
+			break;
+		}
+	}
+	if (offset == 0) {
+		memcpy(command_shapes, "-", sizeof("-"));
+	}
+	command_start_ns = now_ns();
+}
+
+/*
+	PURPOSE: Writes the line of a finished command to the recording
+	INPUT: cmd - the command that just ran
+	RETURN: Nothing
+*/
+void record_command_end (Commands_t* cmd) {
+
+	if (!record_file || !cmd)
+	{
+		return;
+	}
+
+	const unsigned long long end_ns = now_ns();
+	const unsigned long long start_ns = (unsigned long long) record_start.tv_sec * 1000000000ULL + record_start.tv_nsec;
+	pthread_mutex_lock(&record_lock);
+	if (record_file) {
+		fprintf(record_file, "%llu\t%llu\t%s\t", (command_start_ns - start_ns) / 1000,
+			(end_ns - command_start_ns) / 1000, command_shapes);
+		for (unsigned int i = 0; i < cmd->num_cmds; ++i) {
+			fprintf(record_file, "%s%s", i ? " " : "", cmd->cmds[i]);
+		}
+		fputc('\n', record_file);
+		fflush(record_file);
+	}
+	pthread_mutex_unlock(&record_lock);
+}
+
+/*
+	PURPOSE: Replays a recording in forked sessions and prints per command
+		latency percentiles
+	INPUT: record_input_filename - the recording
+		sessions - number of sessions run at the same time
+		paced - if true commands start at their recorded times, else
+			back to back
+		mats - the workspace every session starts from
+		num_mats - number of slots in mats
+		run - runs one parsed command
+	RETURN: 0 if every session finished
+		-1 if it failed
+*/
+int replay_session (const char* record_input_filename, unsigned int sessions, bool paced,
+			Matrix_t** mats, unsigned int num_mats,
+			void (*run) (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats)) {
+
+	if (!mats || !run)
+	{
+		printf("No workspace to replay against!\n");
+		return -1;
+	}
+	if (sessions < 1 || sessions > REPLAY_MAX_SESSIONS)
+	{
+		printf("Sessions must be between 1 and %u!\n", REPLAY_MAX_SESSIONS);
+		return -1;
+	}
+
+	Replay_Command_t* commands = NULL;
+	const unsigned int count = load_recording(record_input_filename, &commands);
+	if (count == 0) {
+		free(commands);
+		return -1;
+	}
+
+	unsigned long long* latencies[REPLAY_MAX_SESSIONS] = {0};
+	pid_t pids[REPLAY_MAX_SESSIONS];
+	int pipes[REPLAY_MAX_SESSIONS];
+	unsigned int started = 0;
+	int result = 0;
+
+	fflush(NULL);
+	const unsigned long long begin = now_ns();
+	for (; started < sessions; ++started) {
+		int fds[2];
+		if (pipe(fds)) {
+			perror("FAILED TO CREATE SESSION PIPE\n");
+			result = -1;
+			break;
+		}
+		pids[started] = fork();
+		if (pids[started] < 0) {
+			perror("FAILED TO FORK SESSION\n");
+			close(fds[0]);
+			close(fds[1]);
+			result = -1;
+			break;
+		}
+		if (pids[started] == 0) {
+			/* the session's own output would only interleave, and its
+			 * trace events would land in the middle of the parent's */
+			close(fds[0]);
+			trace_detach();
+			int null_fd = open("/dev/null", O_WRONLY);
+			if (null_fd >= 0) {
+				dup2(null_fd, STDOUT_FILENO);
+				close(null_fd);
+			}
+			unsigned long long* mine = malloc(count * sizeof(unsigned long long));
+			if (!mine) {
+				_exit(1);
+			}
+			run_replay(commands, count, paced, mats, num_mats, run, mine);
+			const char* p = (const char*) mine;
+			size_t left = count * sizeof(unsigned long long);
+			while (left > 0) {
+				ssize_t put = write(fds[1], p, left);
+				if (put < 0 && errno == EINTR) {
+					continue;
+				}
+				if (put <= 0) {
+					_exit(1);
+				}
+				p += put;
+				left -= put;
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		pipes[started] = fds[0];
+	}
+
+	for (unsigned int s = 0; s < started; ++s) {
+		latencies[s] = malloc(count * sizeof(unsigned long long));
+		char* p = (char*) latencies[s];
+		size_t left = latencies[s] ? count * sizeof(unsigned long long) : 0;
+		while (left > 0) {
+			ssize_t got = read(pipes[s], p, left);
+			if (got < 0 && errno == EINTR) {
+				continue;
+			}
+			if (got <= 0) {
+				break;
+			}
+			p += got;
+			left -= got;
+		}
+		close(pipes[s]);
+		int status = 0;
+		waitpid(pids[s], &status, 0);
+		if (!latencies[s] || left > 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			printf("Session %u did not finish\n", s);
+			result = -1;
+		}
+	}
+	const double seconds = (now_ns() - begin) / 1e9;
+
+	if (result == 0) {
+		printf("Replayed %u commands x %u sessions in %.3f s (%.0f commands/s)\n", count, sessions,
+			seconds, count * (double) sessions / seconds);
+		report_latencies(commands, count, sessions, latencies);
+	}
+	for (unsigned int s = 0; s < started; ++s) {
+		free(latencies[s]);
+	}
+	for (unsigned int i = 0; i < count; ++i) {
+		free(commands[i].line);
+	}
+	free(commands);
+	return result;
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: Reads the monotonic clock
+	INPUT: Nothing
+	RETURN: Nanoseconds since an arbitrary point
+*/
+static unsigned long long now_ns (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+	PURPOSE: Reads every command of a recording
+	INPUT: record_input_filename - the recording
+		commands - set to the commands, to be freed by the caller
+	RETURN: Number of commands read, 0 if none could be
+*/
+static unsigned int load_recording (const char* record_input_filename, Replay_Command_t** commands) {
+	FILE* in = record_input_filename ? fopen(record_input_filename, "r") : NULL;
+	if (!in) {
+		perror("FAILED TO OPEN RECORDING\n");
+		return 0;
+	}
+
+	unsigned int count = 0;
+	unsigned int cap = 0;
+	char* line = NULL;
+	size_t line_cap = 0;
+	ssize_t len;
+	while ((len = getline(&line, &line_cap, in)) > 0) {
+		if (line[len - 1] == '\n') {
+			line[len - 1] = '\0';
+		}
+		unsigned long long start_us;
+		unsigned long long recorded_us;
+		int text = 0;
+		/* start, latency, shapes, then the command line itself */
+		if (sscanf(line, "%llu\t%llu\t%*[^\t]\t%n", &start_us, &recorded_us, &text) < 2 || text == 0
+			|| line[text] == '\0') {
+			continue;
+		}
+		if (count == cap) {
+			cap = cap ? cap * 2 : 64;
+			Replay_Command_t* grown = realloc(*commands, cap * sizeof(Replay_Command_t));
+			if (!grown) {
+				break;
+			}
+			*commands = grown;
+		}
+		Replay_Command_t* c = &(*commands)[count];
+		c->start_us = start_us;
+		c->recorded_us = recorded_us;
+		c->order = count;
+		c->line = strdup(&line[text]);
+		if (!c->line || sscanf(c->line, "%31s", c->name) != 1) {
+			free(c->line);
+			continue;
+		}
+		++count;
+	}
+	free(line);
+	fclose(in);
+	if (count == 0) {
+		printf("%s has no recorded commands\n", record_input_filename);
+	}
+	/* commands are recorded as they finish, so concurrent clients leave
+	 * them out of start order */
+	else {
+		qsort(*commands, count, sizeof(Replay_Command_t), compare_start);
+	}
+	return count;
+}
+
+/*
+	PURPOSE: Runs every recorded command once and times it, inside a session
+	INPUT: commands, count - the recording
+		paced - if true wait for each command's recorded start time
+		mats, num_mats - the session's workspace
+		run - runs one parsed command
+		latencies - set to the nanoseconds each command took
+	RETURN: Nothing
+*/
+static void run_replay (Replay_Command_t* commands, unsigned int count, bool paced, Matrix_t** mats,
+			unsigned int num_mats, void (*run) (Commands_t*, Matrix_t**, unsigned int),
+			unsigned long long* latencies) {
+	const unsigned long long begin = now_ns();
+	for (unsigned int i = 0; i < count; ++i) {
+		if (paced) {
+			const unsigned long long due = begin + (commands[i].start_us - commands[0].start_us) * 1000;
+			const unsigned long long now = now_ns();
+			if (due > now) {
+				struct timespec wait = { (due - now) / 1000000000ULL, (due - now) % 1000000000ULL };
+				while (nanosleep(&wait, &wait) && errno == EINTR) {
+				}
+			}
+		}
+
+		Commands_t* cmd = NULL;
+		latencies[i] = 0;
+		if (!parse_user_input(commands[i].line, &cmd)) {
+			continue;
+		}
+		if (cmd->num_cmds > 1) {
+			const unsigned long long start = now_ns();
+			run(cmd, mats, num_mats);
+			latencies[i] = now_ns() - start;
+		}
+		destroy_commands(&cmd);
+	}
+}
+
+/*
+	PURPOSE: Orders recorded commands by start time for qsort
+	INPUT: a, b - two commands
+	RETURN: <0, 0 or >0 as a started before, with or after b
+*/
+static int compare_start (const void* a, const void* b) {
+	const Replay_Command_t* x = a;
+	const Replay_Command_t* y = b;
+	if (x->start_us != y->start_us) {
+		return (x->start_us > y->start_us) - (x->start_us < y->start_us);
+	}
+	return (x->order > y->order) - (x->order < y->order);
+}
+
+/*
+	PURPOSE: Orders latencies for qsort
+	INPUT: a, b - two latencies
+	RETURN: <0, 0 or >0 as a is less than, equal to or greater than b
+*/
+static int compare_latency (const void* a, const void* b) {
+	const unsigned long long x = *(const unsigned long long*) a;
+	const unsigned long long y = *(const unsigned long long*) b;
+	return (x > y) - (x < y);
+}
+
+/*
+	PURPOSE: Prints p50/p90/p99/max of every command word across sessions,
+		next to the median latency that was recorded
+	INPUT: commands, count - the recording
+		sessions - number of sessions replayed
+		latencies - nanoseconds per command per session
+	RETURN: Nothing
+*/
+static void report_latencies (Replay_Command_t* commands, unsigned int count, unsigned int sessions,
+			unsigned long long** latencies) {
+	unsigned long long* samples = malloc(count * (size_t) sessions * sizeof(unsigned long long));
+	unsigned long long* recorded = malloc(count * sizeof(unsigned long long));
+	bool* reported = calloc(count, sizeof(bool));
+	if (!samples || !recorded || !reported) {
+		free(samples);
+		free(recorded);
+		free(reported);
+		return;
+	}
+
+	printf("%-14s %8s %10s %10s %10s %10s %12s\n", "command", "count", "p50 us", "p90 us", "p99 us",
+		"max us", "recorded p50");
+	for (unsigned int i = 0; i < count; ++i) {
+		if (reported[i]) {
+			continue;
+		}
+		size_t n = 0;
+		size_t r = 0;
+		for (unsigned int j = i; j < count; ++j) {
+			if (strcmp(commands[j].name, commands[i].name) != 0) {
+				continue;
+			}
+			reported[j] = true;
+			recorded[r++] = commands[j].recorded_us;
+			for (unsigned int s = 0; s < sessions; ++s) {
+				samples[n++] = latencies[s][j];
+			}
+		}
+		qsort(samples, n, sizeof(unsigned long long), compare_latency);
+		qsort(recorded, r, sizeof(unsigned long long), compare_latency);
+		/* nearest rank percentiles */
+		printf("%-14s %8zu %10.1f %10.1f %10.1f %10.1f %12llu\n", commands[i].name, n,
+			samples[(n * 50 + 99) / 100 - 1] / 1e3, samples[(n * 90 + 99) / 100 - 1] / 1e3,
+			samples[(n * 99 + 99) / 100 - 1] / 1e3, samples[n - 1] / 1e3, recorded[(r * 50 + 99) / 100 - 1]);
+	}
+	free(samples);
+	free(recorded);
+	free(reported);
+}
@@ -0,0 +1,19 @@
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+/*
+ * A recording has one line per command run:
+ *	<start_us>\t<latency_us>\t<operand shapes>\t<command line>
+ * start_us counts from when recording began. The shapes are
+ * name=ROWSxCOLS for every operand that named a matrix, "-" if none did.
+ */
+
+bool record_open (const char* record_output_filename);
+void record_close (void);
+void record_command_begin (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats);
+void record_command_end (Commands_t* cmd);
+int replay_session (const char* record_input_filename, unsigned int sessions, bool paced,
+			Matrix_t** mats, unsigned int num_mats,
+			void (*run) (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats));
+
+#endif
@@ -0,0 +1,951 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <readline/readline.h>
+
+#include "command.h"
+#include "matrix.h"
+#include "record.h"
+#include "server.h"
+#include "trace.h"
+
+/*
+ * matlab --serve keeps one workspace resident and serves it over a Unix
+ * domain socket. A single epoll thread accepts clients and reads their
+ * frames. Each connection's requests are queued in order and a pool of
+ * worker threads runs them. A connection is only ever on one worker, so
+ * its responses come back in request order.
+ *
+ * Commands that add to the workspace take the workspace lock exclusively.
+ * Everything else shares it and locks only the matrices it names, with one
+ * reader/writer lock per stripe of matrices.
+ */
+
+#define SERVER_WORKERS 4
+#define SERVER_MAX_EVENTS 64
+#define SERVER_LOCK_STRIPES 64
+#define SERVER_READ_CHUNK (64 << 10)
+/* largest matrix data a client may put, and the largest frame that can hold
+ * it: name length, name, rows, cols and the data. Anything bigger is refused
+ * before it is buffered. */
+#define SERVER_MAX_PUT_DATA (1U << 30)
+#define SERVER_MAX_FRAME (3 * sizeof(unsigned int) + MATRIX_NAME_LEN + 1 + SERVER_MAX_PUT_DATA)
+/* the client keeps at most this many requests in flight */
+#define CLIENT_PIPELINE_DEPTH 64
+
+typedef struct Request {
+	unsigned int type;
+	unsigned int length;
+	char* payload;
+	struct Request* next;
+}Request_t;
+
+typedef struct Connection {
+	int fd;
+	pthread_mutex_t lock;
+	char* in;		/* bytes read but not yet a whole frame, epoll thread only */
+	size_t in_len;
+	size_t in_cap;
+	Request_t* head;	/* requests waiting for a worker */
+	Request_t* tail;
+	bool scheduled;		/* on the ready queue or being run by a worker */
+	bool closed;		/* the client is gone or done sending */
+	struct Connection* next_ready;
+}Connection_t;
+
+typedef enum {
+	ACCESS_READ,		/* only reads the named matrices */
+	ACCESS_IN_PLACE,	/* changes the data of the first named matrix */
+	ACCESS_WORKSPACE	/* adds to or replaces matrices in the workspace */
+}Command_Access_t;
+
+static Matrix_t** workspace = NULL;
+static unsigned int workspace_size = 0;
+static command_runner run_command = NULL;
+
+static pthread_rwlock_t workspace_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_rwlock_t matrix_locks[SERVER_LOCK_STRIPES];
+
+static pthread_mutex_t ready_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+static Connection_t* ready_head = NULL;
+static Connection_t* ready_tail = NULL;
+static bool server_stopping = false;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+/*protected functions*/
+static void handle_stop_signal (int sig);
+static bool set_nonblocking (int fd);
+static bool send_full (int fd, const void* buf, size_t len);
+static bool recv_full (int fd, void* buf, size_t len);
+static bool send_frame (int fd, unsigned int type, const void* payload, unsigned int length);
+static bool read_connection (Connection_t* conn);
+static bool queue_frames (Connection_t* conn, bool* queued);
+static void schedule_connection (Connection_t* conn);
+static void free_connection (Connection_t* conn);
+static void* server_worker (void* arg);
+static void run_request (Connection_t* conn, Request_t* req);
+static void run_command_request (Connection_t* conn, Request_t* req);
+static void run_put_request (Connection_t* conn, Request_t* req);
+static void run_get_request (Connection_t* conn, Request_t* req);
+static Matrix_t* find_matrix (const char* name);
+static pthread_rwlock_t* matrix_lock (Matrix_t* m);
+static Command_Access_t command_access (Commands_t* cmd);
+
+/*
+	PURPOSE: Serves the workspace to clients on a Unix domain socket until
+		SIGINT or SIGTERM
+	INPUT: socket_path - filesystem path of the socket
+		mats - the workspace
+		num_mats - number of slots in mats
+		run - runs one parsed command against the workspace
+	RETURN: 0 after a clean shutdown
+		-1 if the server could not start
+*/
+int serve_matrices (const char* socket_path, Matrix_t** mats, unsigned int num_mats, command_runner run) {
+
+	if (!socket_path || strlen(socket_path) >= sizeof(((struct sockaddr_un*) 0)->sun_path))
+	{
+		printf("Socket path is missing or too long!\n");
+		return -1;
+	}
+	if (!mats || num_mats == 0 || !run)
+	{
+		printf("No workspace to serve!\n");
+		return -1;
+	}
+
+	workspace = mats;
+	workspace_size = num_mats;
+	run_command = run;
+	for (unsigned int i = 0; i < SERVER_LOCK_STRIPES; ++i) {
+		pthread_rwlock_init(&matrix_locks[i], NULL);
+	}
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		perror("FAILED TO CREATE SOCKET\n");
+		return -1;
+	}
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	unlink(socket_path);
+	if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) || listen(listen_fd, SOMAXCONN)
+		|| !set_nonblocking(listen_fd)) {
+		perror("FAILED TO LISTEN ON SOCKET\n");
+		close(listen_fd);
+		return -1;
+	}
+
+	int epoll_fd = epoll_create1(0);
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev)) {
+		perror("FAILED TO SET UP EPOLL\n");
+		close(listen_fd);
+		return -1;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_stop_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_t workers[SERVER_WORKERS];
+	for (unsigned int i = 0; i < SERVER_WORKERS; ++i) {
+		pthread_create(&workers[i], NULL, server_worker, NULL);
+	}
+	printf("Serving %u matrix slots on %s\n", num_mats, socket_path);
+	fflush(stdout);
+
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	while (!stop_requested) {
+		int ready = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("EPOLL WAIT FAILED\n");
+			break;
+		}
+
+		for (int i = 0; i < ready; ++i) {
+			Connection_t* conn = events[i].data.ptr;
+			if (!conn) {
+				/* the listening socket, accept everyone waiting */
+				int fd;
+				while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+					conn = calloc(1, sizeof(Connection_t));
+					if (!conn || !set_nonblocking(fd)) {
+						free(conn);
+						close(fd);
+						continue;
+					}
+					conn->fd = fd;
+					pthread_mutex_init(&conn->lock, NULL);
+					struct epoll_event cev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn };
+					if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &cev)) {
+						free_connection(conn);
+					}
+				}
+				continue;
+			}
+
+			if (!read_connection(conn)) {
+				/* no more requests, the worker finishes what is queued */
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+				pthread_mutex_lock(&conn->lock);
+				conn->closed = true;
+				const bool idle = !conn->scheduled;
+				pthread_mutex_unlock(&conn->lock);
+				if (idle) {
+					free_connection(conn);
+				}
+			}
+		}
+	}
+
+	pthread_mutex_lock(&ready_lock);
+	server_stopping = true;
+	pthread_cond_broadcast(&ready_cond);
+	pthread_mutex_unlock(&ready_lock);
+	for (unsigned int i = 0; i < SERVER_WORKERS; ++i) {
+		pthread_join(workers[i], NULL);
+	}
+
+	close(epoll_fd);
+	close(listen_fd);
+	unlink(socket_path);
+	printf("Server on %s stopped\n", socket_path);
+	return 0;
+}
+
+/*
+	PURPOSE: Command line client for matlab --serve. Lines are sent as
+		commands, "put <matrix_file>" uploads a matrix file and
+		"get <matrix_name> <matrix_file>" downloads one. When stdin is not
+		a terminal the requests are pipelined
+	INPUT: socket_path - filesystem path of the server's socket
+	RETURN: 0 when the input ends or on exit
+		-1 if the server could not be reached
+*/
+int run_matrix_client (const char* socket_path) {
+
+	if (!socket_path || strlen(socket_path) >= sizeof(((struct sockaddr_un*) 0)->sun_path))
+	{
+		printf("Socket path is missing or too long!\n");
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+		perror("FAILED TO CONNECT TO SERVER\n");
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	const bool interactive = isatty(STDIN_FILENO);
+	const unsigned int depth = interactive ? 1 : CLIENT_PIPELINE_DEPTH;
+	/* where each in flight get is saved, NULL for other requests */
+	char* pending[CLIENT_PIPELINE_DEPTH] = {0};
+	unsigned int first = 0;
+	unsigned int in_flight = 0;
+	bool input_done = false;
+	int result = 0;
+
+	while (!input_done || in_flight > 0) {
+		if (!input_done && in_flight < depth) {
+			char* line = NULL;
+			size_t cap = 0;
+			if (interactive) {
+				line = readline("> ");
+			}
+			else if (getline(&line, &cap, stdin) < 0) {
+				free(line);
+				line = NULL;
+			}
+			if (line) {
+				line[strcspn(line, "\n")] = '\0';
+			}
+			if (!line || strncmp(line, "exit", strlen("exit") + 1) == 0) {
+				free(line);
+				input_done = true;
+				shutdown(fd, SHUT_WR);
+				continue;
+			}
+
+			char* save_to = NULL;
+			bool sent = false;
+			char name[MATRIX_NAME_LEN + 1];
+			char path[4096];
+			if (sscanf(line, "get %25s %4095s", name, path) == 2) {
+				save_to = strdup(path);
+				sent = send_frame(fd, FRAME_GET, name, strlen(name) + 1);
+			}
+			else if (sscanf(line, "put %4095s", path) == 1) {
+				FILE* in = fopen(path, "r");
+				char* bytes = NULL;
+				long size = 0;
+				if (in && fseek(in, 0, SEEK_END) == 0 && (size = ftell(in)) > 0 && (size_t) size > SERVER_MAX_FRAME) {
+					printf("Matrix file %s is larger than the server accepts\n", path);
+					fclose(in);
+					free(line);
+					continue;
+				}
+				if (in && size > 0 && fseek(in, 0, SEEK_SET) == 0
+					&& (bytes = malloc(size)) && fread(bytes, 1, size, in) == (size_t) size) {
+					sent = send_frame(fd, FRAME_PUT, bytes, size);
+				}
+				else {
+					printf("Could not read matrix file %s\n", path);
+					free(bytes);
+					if (in) {
+						fclose(in);
+					}
+					free(line);
+					continue;
+				}
+				free(bytes);
+				fclose(in);
+			}
+			else if (line[0] != '\0') {
+				sent = send_frame(fd, FRAME_COMMAND, line, strlen(line) + 1);
+			}
+			else {
+				free(line);
+				continue;
+			}
+			free(line);
+			if (!sent) {
+				printf("Lost connection to the server\n");
+				free(save_to);
+				result = -1;
+				break;
+			}
+			pending[(first + in_flight) % CLIENT_PIPELINE_DEPTH] = save_to;
+			++in_flight;
+			continue;
+		}
+
+		/* read the oldest outstanding response */
+		Frame_Header_t header;
+		if (!recv_full(fd, &header, sizeof(header))) {
+			printf("Lost connection to the server\n");
+			result = -1;
+			break;
+		}
+		char* payload = malloc(header.length + 1);
+		if (!payload || !recv_full(fd, payload, header.length)) {
+			printf("Lost connection to the server\n");
+			free(payload);
+			result = -1;
+			break;
+		}
+		payload[header.length] = '\0';
+
+		char* save_to = pending[first];
+		pending[first] = NULL;
+		first = (first + 1) % CLIENT_PIPELINE_DEPTH;
+		--in_flight;
+
+		if (save_to && header.type == FRAME_OK) {
+			int out = open(save_to, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+			if (out < 0 || !send_full(out, payload, header.length)) {
+				printf("Could not save matrix to %s\n", save_to);
+			}
+			else {
+				printf("Matrix saved to %s\n", save_to);
+			}
+			if (out >= 0) {
+				close(out);
+			}
+		}
+		else {
+			fwrite(payload, 1, header.length, stdout);
+			fflush(stdout);
+		}
+		free(save_to);
+		free(payload);
+	}
+
+	for (unsigned int i = 0; i < CLIENT_PIPELINE_DEPTH; ++i) {
+		free(pending[i]);
+	}
+	close(fd);
+	return result;
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: Asks the epoll loop to stop
+	INPUT: sig - the signal
+	RETURN: Nothing
+*/
+static void handle_stop_signal (int sig) {
+	stop_requested = 1;
+}
+
+/*
+	PURPOSE: Puts a file descriptor in non blocking mode
+	INPUT: fd - the descriptor
+	RETURN: If successful returns true
+		else false
+*/
+static bool set_nonblocking (int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/*
+	PURPOSE: Writes all of a buffer, waiting for room on non blocking sockets
+	INPUT: fd - where the bytes go
+		buf - bytes to write
+		len - number of bytes
+	RETURN: If everything was written returns true
+		else false
+*/
+static bool send_full (int fd, const void* buf, size_t len) {
+	const char* p = buf;
+	while (len > 0) {
+		ssize_t sent = send(fd, p, len, MSG_NOSIGNAL);
+		if (sent < 0 && errno == ENOTSOCK) {
+			sent = write(fd, p, len);
+		}
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			return false;
+		}
+		p += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Reads exactly len bytes from a blocking socket
+	INPUT: fd - where the bytes come from
+		buf - where the bytes go
+		len - number of bytes
+	RETURN: If all bytes arrived returns true
+		else false
+*/
+static bool recv_full (int fd, void* buf, size_t len) {
+	char* p = buf;
+	while (len > 0) {
+		ssize_t got = recv(fd, p, len, 0);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			return false;
+		}
+		p += got;
+		len -= got;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Sends one frame header and its payload
+	INPUT: fd - socket to send on
+		type - request type or response status
+		payload - bytes after the header
+		length - number of payload bytes
+	RETURN: If the frame was sent returns true
+		else false
+*/
+static bool send_frame (int fd, unsigned int type, const void* payload, unsigned int length) {
+	Frame_Header_t header = { type, length };
+	return send_full(fd, &header, sizeof(header)) && send_full(fd, payload, length);
+}
+
+/*
+	PURPOSE: Reads what a client sent and queues every whole frame
+	INPUT: conn - the readable connection
+	RETURN: false once the client has closed or broken its connection
+		or sent a frame larger than SERVER_MAX_FRAME, else true
+*/
+static bool read_connection (Connection_t* conn) {
+	const size_t max_cap = sizeof(Frame_Header_t) + SERVER_MAX_FRAME;
+	bool open = true;
+	bool queued = false;
+	while (open) {
+		/* the buffer holds at most one partial frame, so it never needs
+		 * to grow past the largest frame allowed */
+		if (conn->in_cap - conn->in_len < SERVER_READ_CHUNK && conn->in_cap < max_cap) {
+			size_t cap = conn->in_cap + SERVER_READ_CHUNK;
+			if (cap > max_cap) {
+				cap = max_cap;
+			}
+			char* grown = realloc(conn->in, cap);
+			if (!grown) {
+				open = false;
+				break;
+			}
+			conn->in = grown;
+			conn->in_cap = cap;
+		}
+		ssize_t got = recv(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len, 0);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (got <= 0) {
+			/* still run whatever arrived before the client hung up */
+			open = false;
+			break;
+		}
+		conn->in_len += got;
+		if (!queue_frames(conn, &queued)) {
+			open = false;
+			break;
+		}
+	}
+
+	if (queued) {
+		schedule_connection(conn);
+	}
+	return open;
+}
+
+/*
+	PURPOSE: Moves every whole frame in a connection's buffer onto its
+		request queue, keeping the partial frame that follows
+	INPUT: conn - the connection
+		queued - set to true if a request was queued
+	RETURN: false if a frame is larger than SERVER_MAX_FRAME or a request
+		could not be allocated, else true
+*/
+static bool queue_frames (Connection_t* conn, bool* queued) {
+	size_t used = 0;
+	bool ok = true;
+	while (conn->in_len - used >= sizeof(Frame_Header_t)) {
+		Frame_Header_t header;
+		memcpy(&header, conn->in + used, sizeof(header));
+		if (header.length > SERVER_MAX_FRAME) {
+			printf("Refusing a %u byte frame\n", header.length);
+			ok = false;
+			break;
+		}
+		if (conn->in_len - used - sizeof(header) < header.length) {
+			break;
+		}
+		Request_t* req = calloc(1, sizeof(Request_t));
+		char* payload = malloc((size_t) header.length + 1);
+		if (!req || !payload) {
+			free(req);
+			free(payload);
+			ok = false;
+			break;
+		}
+		memcpy(payload, conn->in + used + sizeof(header), header.length);
+		payload[header.length] = '\0';
+		req->type = header.type;
+		req->length = header.length;
+		req->payload = payload;
+		used += sizeof(header) + header.length;
+
+		pthread_mutex_lock(&conn->lock);
+		if (conn->tail) {
+			conn->tail->next = req;
+		}
+		else {
+			conn->head = req;
+		}
+		conn->tail = req;
+		pthread_mutex_unlock(&conn->lock);
+		*queued = true;
+	}
+	memmove(conn->in, conn->in + used, conn->in_len - used);
+	conn->in_len -= used;
+	return ok;
+}
+
+/*
+	PURPOSE: Hands a connection with queued requests to the workers unless
+		one already has it
+	INPUT: conn - the connection
+	RETURN: Nothing
+*/
+static void schedule_connection (Connection_t* conn) {
+	pthread_mutex_lock(&conn->lock);
+	const bool already = conn->scheduled;
+	conn->scheduled = true;
+	pthread_mutex_unlock(&conn->lock);
+	if (already) {
+		return;
+	}
+
+	pthread_mutex_lock(&ready_lock);
+	conn->next_ready = NULL;
+	if (ready_tail) {
+		ready_tail->next_ready = conn;
+	}
+	else {
+		ready_head = conn;
+	}
+	ready_tail = conn;
+	pthread_cond_signal(&ready_cond);
+	pthread_mutex_unlock(&ready_lock);
+}
+
+/*
+	PURPOSE: Closes a connection and frees everything it holds
+	INPUT: conn - connection no thread is using anymore
+	RETURN: Nothing
+*/
+static void free_connection (Connection_t* conn) {
+	Request_t* req = conn->head;
+	while (req) {
+		Request_t* next = req->next;
+		free(req->payload);
+		free(req);
+		req = next;
+	}
+	close(conn->fd);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn->in);
+	free(conn);
+}
+
+/*
+	PURPOSE: Worker loop, runs the queued requests of one connection at a
+		time in the order they arrived
+	INPUT: arg - unused
+	RETURN: NULL
+*/
+static void* server_worker (void* arg) {
+	for (;;) {
+		pthread_mutex_lock(&ready_lock);
+		while (!ready_head && !server_stopping) {
+			pthread_cond_wait(&ready_cond, &ready_lock);
+		}
+		if (!ready_head) {
+			pthread_mutex_unlock(&ready_lock);
+			return NULL;
+		}
+		Connection_t* conn = ready_head;
+		ready_head = conn->next_ready;
+		if (!ready_head) {
+			ready_tail = NULL;
+		}
+		pthread_mutex_unlock(&ready_lock);
+
+		for (;;) {
+			pthread_mutex_lock(&conn->lock);
+			Request_t* req = conn->head;
+			if (!req) {
+				conn->scheduled = false;
+				const bool done = conn->closed;
+				pthread_mutex_unlock(&conn->lock);
+				if (done) {
+					free_connection(conn);
+				}
+				break;
+			}
+			conn->head = req->next;
+			if (!conn->head) {
+				conn->tail = NULL;
+			}
+			pthread_mutex_unlock(&conn->lock);
+
+			run_request(conn, req);
+			free(req->payload);
+			free(req);
+		}
+	}
+}
+
+/*
+	PURPOSE: Runs one request and sends its response
+	INPUT: conn - connection the request came from
+		req - the request
+	RETURN: Nothing
+*/
+static void run_request (Connection_t* conn, Request_t* req) {
+	if (req->type == FRAME_COMMAND) {
+		run_command_request(conn, req);
+	}
+	else if (req->type == FRAME_PUT) {
+		run_put_request(conn, req);
+	}
+	else if (req->type == FRAME_GET) {
+		run_get_request(conn, req);
+	}
+	else {
+		const char* msg = "Unknown request type\n";
+		send_frame(conn->fd, FRAME_ERROR, msg, strlen(msg));
+	}
+}
+
+/*
+	PURPOSE: Runs a command line under the locks it needs and sends back
+		everything it printed
+	INPUT: conn - connection the request came from
+		req - the command request
+	RETURN: Nothing
+*/
+static void run_command_request (Connection_t* conn, Request_t* req) {
+	char* output = NULL;
+	size_t output_len = 0;
+	FILE* out = open_memstream(&output, &output_len);
+	Commands_t* cmd = NULL;
+
+	if (!out) {
+		const char* msg = "Server out of memory\n";
+		send_frame(conn->fd, FRAME_ERROR, msg, strlen(msg));
+		return;
+	}
+	set_command_output(out);
+
+	if (parse_user_input(req->payload, &cmd) && cmd->num_cmds > 1) {
+		const Command_Access_t access = command_access(cmd);
+		pthread_rwlock_t* locks[2] = { NULL, NULL };
+
+		if (access == ACCESS_WORKSPACE) {
+			pthread_rwlock_wrlock(&workspace_lock);
+		}
+		else {
+			pthread_rwlock_rdlock(&workspace_lock);
+			Matrix_t* first = find_matrix(cmd->cmds[1]);
+			Matrix_t* second = access == ACCESS_READ && cmd->num_cmds > 2 ? find_matrix(cmd->cmds[2]) : NULL;
+			locks[0] = first ? matrix_lock(first) : NULL;
+			locks[1] = second ? matrix_lock(second) : NULL;
+			/* stripes are always taken in address order */
+			if (locks[0] && locks[1] && locks[1] < locks[0]) {
+				pthread_rwlock_t* swap = locks[0];
+				locks[0] = locks[1];
+				locks[1] = swap;
+			}
+			if (locks[0] == locks[1]) {
+				locks[1] = NULL;
+			}
+			for (unsigned int i = 0; i < 2; ++i) {
+				if (!locks[i]) {
+					continue;
+				}
+				if (access == ACCESS_IN_PLACE) {
+					pthread_rwlock_wrlock(locks[i]);
+				}
+				else {
+					pthread_rwlock_rdlock(locks[i]);
+				}
+			}
+		}
+
+		record_command_begin(cmd, workspace, workspace_size);
+		trace_command_begin(cmd);
+		run_command(cmd, workspace, workspace_size);
+		trace_command_end(cmd);
+		record_command_end(cmd);
+
+		for (int i = 1; i >= 0; --i) {
+			if (locks[i]) {
+				pthread_rwlock_unlock(locks[i]);
+			}
+		}
+		pthread_rwlock_unlock(&workspace_lock);
+	}
+	if (cmd) {
+		destroy_commands(&cmd);
+	}
+
+	set_command_output(NULL);
+	fclose(out);
+	send_frame(conn->fd, FRAME_OK, output, output_len);
+	free(output);
+}
+
+/*
+	PURPOSE: Stores an uploaded matrix in the workspace
+	INPUT: conn - connection the request came from
+		req - payload in the read_matrix file layout
+	RETURN: Nothing
+*/
+static void run_put_request (Connection_t* conn, Request_t* req) {
+	char reply[128];
+	unsigned int name_len = 0;
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	const char* p = req->payload;
+	size_t left = req->length;
+
+	if (left >= sizeof(unsigned int)) {
+		memcpy(&name_len, p, sizeof(unsigned int));
+	}
+	if (left < 3 * sizeof(unsigned int) + name_len || name_len == 0 || name_len > MATRIX_NAME_LEN) {
+		snprintf(reply, sizeof(reply), "Uploaded matrix header is invalid\n");
+		send_frame(conn->fd, FRAME_ERROR, reply, strlen(reply));
+		return;
+	}
+	char name[MATRIX_NAME_LEN];
+	memcpy(name, p + sizeof(unsigned int), name_len);
+	name[name_len - 1] = '\0';
+	p += sizeof(unsigned int) + name_len;
+	memcpy(&rows, p, sizeof(unsigned int));
+	memcpy(&cols, p + sizeof(unsigned int), sizeof(unsigned int));
+	p += 2 * sizeof(unsigned int);
+	left -= 3 * sizeof(unsigned int) + name_len;
+	if (rows == 0 || cols == 0 || left / sizeof(unsigned int) / cols < rows) {
+		snprintf(reply, sizeof(reply), "Uploaded matrix is shorter than %u x %u\n", rows, cols);
+		send_frame(conn->fd, FRAME_ERROR, reply, strlen(reply));
+		return;
+	}
+
+	Matrix_t* m = NULL;
+	if (!create_matrix_uninitialized(&m, name, rows, cols)) {
+		snprintf(reply, sizeof(reply), "Could not create matrix (%s)\n", name);
+		send_frame(conn->fd, FRAME_ERROR, reply, strlen(reply));
+		return;
+	}
+	memcpy(m->data, p, (size_t) rows * cols * sizeof(unsigned int));
+
+	pthread_rwlock_wrlock(&workspace_lock);
+	const bool added = add_matrix_to_array(workspace, m, workspace_size) != -1;
+	pthread_rwlock_unlock(&workspace_lock);
+	if (!added) {
+		destroy_matrix(&m);
+		snprintf(reply, sizeof(reply), "Could not add matrix to array!\n");
+		send_frame(conn->fd, FRAME_ERROR, reply, strlen(reply));
+		return;
+	}
+	snprintf(reply, sizeof(reply), "Matrix (%s,%u,%u) is stored on the server\n", name, rows, cols);
+	send_frame(conn->fd, FRAME_OK, reply, strlen(reply));
+}
+
+/*
+	PURPOSE: Sends a workspace matrix back in the read_matrix file layout
+	INPUT: conn - connection the request came from
+		req - payload holding the matrix name
+	RETURN: Nothing
+*/
+static void run_get_request (Connection_t* conn, Request_t* req) {
+	char reply[128];
+
+	pthread_rwlock_rdlock(&workspace_lock);
+	Matrix_t* m = find_matrix(req->payload);
+	if (!m) {
+		pthread_rwlock_unlock(&workspace_lock);
+		snprintf(reply, sizeof(reply), "Matrix (%.25s) doesn't exist\n", req->payload);
+		send_frame(conn->fd, FRAME_ERROR, reply, strlen(reply));
+		return;
+	}
+	pthread_rwlock_t* lock = matrix_lock(m);
+	pthread_rwlock_rdlock(lock);
+
+	const unsigned int name_len = strlen(m->name) + 1;
+	const size_t row_bytes = (size_t) m->cols * sizeof(unsigned int);
+	const size_t length = 3 * sizeof(unsigned int) + name_len + m->rows * row_bytes;
+	char* bytes = length <= UINT_MAX ? malloc(length) : NULL;
+	if (bytes) {
+		char* p = bytes;
+		memcpy(p, &name_len, sizeof(unsigned int));
+		p += sizeof(unsigned int);
+		memcpy(p, m->name, name_len);
+		p += name_len;
+		memcpy(p, &m->rows, sizeof(unsigned int));
+		p += sizeof(unsigned int);
+		memcpy(p, &m->cols, sizeof(unsigned int));
+		p += sizeof(unsigned int);
+		for (unsigned int i = 0; i < m->rows; ++i) {
+			memcpy(p, &m->data[(size_t) i * m->stride], row_bytes);
+			p += row_bytes;
+		}
+	}
+	pthread_rwlock_unlock(lock);
+	pthread_rwlock_unlock(&workspace_lock);
+
+	if (!bytes) {
+		snprintf(reply, sizeof(reply), "Matrix is too big to send\n");
+		send_frame(conn->fd, FRAME_ERROR, reply, strlen(reply));
+		return;
+	}
+	send_frame(conn->fd, FRAME_OK, bytes, length);
+	free(bytes);
+}
+
+/*
+	PURPOSE: Finds a workspace matrix by name, caller holds workspace_lock
+	INPUT: name - the matrix name
+	RETURN: The matrix, NULL if there is none by that name
+*/
+static Matrix_t* find_matrix (const char* name) {
+	for (unsigned int i = 0; i < workspace_size; ++i) {
+		if (workspace[i] && strncmp(workspace[i]->name, name, MATRIX_NAME_LEN) == 0) {
+			return workspace[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+	PURPOSE: Lock guarding a matrix's data. Views share their owner's lock
+	INPUT: m - the matrix
+	RETURN: The lock of the stripe the data's owner hashes to
+*/
+static pthread_rwlock_t* matrix_lock (Matrix_t* m) {
+	const Matrix_t* owner = m->parent ? m->parent : m;
+	const unsigned long hash = ((unsigned long) owner >> 4) * 2654435761UL;
+	return &matrix_locks[(hash >> 8) % SERVER_LOCK_STRIPES];
+}
+
+/*
+	PURPOSE: Decides which locks a command needs
+	INPUT: cmd - the parsed command
+	RETURN: How the command touches the workspace
+*/
+static Command_Access_t command_access (Commands_t* cmd) {
+	static const char* readers[] = { "display", "equal", "write", "export", "verify", "sum", "stats", NULL };
+	/* checkpoint only reads the data but resets its dirty flags */
+	static const char* in_place[] = { "shift", "random", "scalar", "checkpoint", NULL };
+
+	for (unsigned int i = 0; readers[i]; ++i) {
+		if (strcmp(cmd->cmds[0], readers[i]) == 0) {
+			return ACCESS_READ;
+		}
+	}
+	for (unsigned int i = 0; in_place[i]; ++i) {
+		if (strcmp(cmd->cmds[0], in_place[i]) == 0) {
+			return ACCESS_IN_PLACE;
+		}
+	}
+	if (strcmp(cmd->cmds[0], "transpose") == 0 && cmd->num_cmds == 2) {
+		return ACCESS_IN_PLACE;
+	}
+	return ACCESS_WORKSPACE;
+}
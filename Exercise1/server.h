@@ -0,0 +1,28 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+/*
+ * Wire protocol between matlab --serve and its clients. Every message is a
+ * Frame_Header_t followed by length bytes of payload. Requests carry their
+ * type, responses a status. A client may send any number of requests
+ * before reading, the responses come back in the same order.
+ */
+
+#define FRAME_COMMAND 1		/* payload: command line, response: its output */
+#define FRAME_PUT 2		/* payload: matrix in the read_matrix file layout */
+#define FRAME_GET 3		/* payload: matrix name, response: the matrix in file layout */
+
+#define FRAME_OK 0
+#define FRAME_ERROR 1
+
+typedef struct {
+	unsigned int type;	/* request type or response status */
+	unsigned int length;	/* bytes of payload that follow */
+}Frame_Header_t;
+
+typedef void (*command_runner) (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats);
+
+int serve_matrices (const char* socket_path, Matrix_t** mats, unsigned int num_mats, command_runner run);
+int run_matrix_client (const char* socket_path);
+
+#endif
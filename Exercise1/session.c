@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrix.h"
+#include "parallel.h"
+#include "session.h"
+
+/*
+ * save-session writes every matrix of the workspace into one image.
+ * load-session maps each matrix's region of the image copy-on-write
+ * instead of reading it, so loading costs a few system calls per matrix.
+ * Pages are read in the first time they are used. Changes to loaded
+ * matrices never reach the image.
+ */
+
+/* each thread of a parallel save writes at least this much */
+#define SESSION_MIN_BAND_BYTES (1 << 20)
+
+typedef struct {
+	int fd;
+	off_t data_offset;
+	Matrix_t* m;
+	bool failed;
+}Session_Write_Args_t;
+
+/*protected functions*/
+static size_t align_up (size_t bytes);
+static bool pwrite_full (int fd, const void* buf, size_t len, off_t offset);
+static void write_rows_band (void* arg, unsigned int row_begin, unsigned int row_end);
+
+/*
+	PURPOSE: Saves every matrix of the workspace into one session image.
+		The image is written next to the file and renamed over it, so
+		an old image is never left half overwritten
+	INPUT: session_filename - the image file
+		mats - the workspace
+		num_mats - number of slots in mats
+	RETURN: If successful returns true
+		else false
+*/
+bool save_session (const char* session_filename, Matrix_t** mats, unsigned int num_mats) {
+
+	if (!session_filename)
+	{
+		printf("No filename!\n");
+		return false;
+	}
+	if (!mats)
+	{
+		printf("No list of matrices!\n");
+		return false;
+	}
+
+	Session_Header_t header = { SESSION_MAGIC, SESSION_VERSION, 0, SESSION_ALIGN };
+	Session_Entry_t* entries = calloc(num_mats ? num_mats : 1, sizeof(Session_Entry_t));
+	Matrix_t** saved = calloc(num_mats ? num_mats : 1, sizeof(Matrix_t*));
+	if (!entries || !saved) {
+		free(entries);
+		free(saved);
+		return false;
+	}
+	size_t offset = align_up(sizeof(header) + num_mats * sizeof(Session_Entry_t));
+	for (unsigned int i = 0; i < num_mats; ++i) {
+		if (!mats[i]) {
+			continue;
+		}
+		Session_Entry_t* e = &entries[header.count];
+		memcpy(e->name, mats[i]->name, MATRIX_NAME_LEN);
+		e->rows = mats[i]->rows;
+		e->cols = mats[i]->cols;
+		e->data_offset = offset;
+		offset += align_up((size_t) e->rows * e->cols * sizeof(unsigned int));
+		saved[header.count++] = mats[i];
+	}
+
+	const size_t name_len = strlen(session_filename);
+	char* tmp_filename = malloc(name_len + sizeof(".tmp"));
+	if (!tmp_filename) {
+		free(entries);
+		free(saved);
+		return false;
+	}
+	memcpy(tmp_filename, session_filename, name_len);
+	memcpy(tmp_filename + name_len, ".tmp", sizeof(".tmp"));
+
+	bool ok = false;
+	int fd = open(tmp_filename, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("FAILED TO CREATE/OPEN SESSION FILE FOR WRITING\n");
+		goto done;
+	}
+	/* the padding between regions stays a hole */
+	if (ftruncate(fd, offset) || !pwrite_full(fd, &header, sizeof(header), 0)
+		|| !pwrite_full(fd, entries, header.count * sizeof(Session_Entry_t), sizeof(header))) {
+		perror("FAILED TO WRITE SESSION INDEX\n");
+		goto done;
+	}
+	for (unsigned int i = 0; i < header.count; ++i) {
+		Session_Write_Args_t args = { fd, entries[i].data_offset, saved[i], false };
+		const size_t row_bytes = (size_t) saved[i]->cols * sizeof(unsigned int);
+		const unsigned int min_rows = SESSION_MIN_BAND_BYTES / row_bytes + 1;
+		parallel_for_rows("save", saved[i]->name, saved[i]->rows, saved[i]->cols, min_rows, write_rows_band, &args);
+		if (args.failed) {
+			goto done;
+		}
+	}
+	if (close(fd)) {
+		fd = -1;
+		perror("FAILED TO WRITE SESSION FILE\n");
+		goto done;
+	}
+	fd = -1;
+	if (rename(tmp_filename, session_filename)) {
+		perror("FAILED TO REPLACE SESSION FILE\n");
+		goto done;
+	}
+	ok = true;
+
+done:
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (!ok) {
+		unlink(tmp_filename);
+	}
+	free(tmp_filename);
+	free(entries);
+	free(saved);
+	return ok;
+}
+
+/*
+	PURPOSE: Maps every matrix of a session image and adds them to the
+		workspace in their saved order. Nothing is added unless all of
+		them could be mapped
+	INPUT: session_filename - the image file
+		mats - the workspace
+		num_mats - number of slots in mats
+		loaded - set to the number of matrices added
+	RETURN: If successful returns true
+		else false
+*/
+bool load_session (const char* session_filename, Matrix_t** mats, unsigned int num_mats, unsigned int* loaded) {
+
+	if (!session_filename)
+	{
+		printf("No filename!\n");
+		return false;
+	}
+	if (!mats || !loaded)
+	{
+		printf("No list of matrices!\n");
+		return false;
+	}
+	*loaded = 0;
+
+	int fd = open(session_filename, O_RDONLY);
+	if (fd < 0) {
+		perror("FAILED TO OPEN SESSION FILE FOR READING\n");
+		return false;
+	}
+	struct stat st;
+	Session_Header_t header;
+	Session_Entry_t* entries = NULL;
+	Matrix_t** restored = NULL;
+	unsigned int mapped = 0;
+	bool ok = false;
+
+	if (fstat(fd, &st) || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+		|| header.magic != SESSION_MAGIC || header.version != SESSION_VERSION
+		|| header.align == 0 || header.align % sysconf(_SC_PAGESIZE) != 0
+		|| (size_t) st.st_size < sizeof(header) + (size_t) header.count * sizeof(Session_Entry_t)) {
+		printf("%s is not a session image\n", session_filename);
+		goto done;
+	}
+	entries = calloc(header.count ? header.count : 1, sizeof(Session_Entry_t));
+	restored = calloc(header.count ? header.count : 1, sizeof(Matrix_t*));
+	if (!entries || !restored || pread(fd, entries, header.count * sizeof(Session_Entry_t), sizeof(header))
+		!= (ssize_t) (header.count * sizeof(Session_Entry_t))) {
+		printf("FAILED TO READ SESSION INDEX\n");
+		goto done;
+	}
+
+	for (; mapped < header.count; ++mapped) {
+		Session_Entry_t* e = &entries[mapped];
+		const size_t bytes = (size_t) e->rows * e->cols * sizeof(unsigned int);
+		e->name[MATRIX_NAME_LEN - 1] = '\0';
+		if (e->rows == 0 || e->cols == 0 || e->data_offset % header.align
+			|| e->data_offset > (unsigned long long) st.st_size || st.st_size - e->data_offset < bytes) {
+			printf("Session entry (%s) is outside of %s\n", e->name, session_filename);
+			goto done;
+		}
+		void* mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, e->data_offset);
+		if (mapping == MAP_FAILED) {
+			perror("FAILED TO MAP SESSION MATRIX\n");
+			goto done;
+		}
+		Matrix_t* m = calloc(1, sizeof(Matrix_t));
+		if (!m) {
+			munmap(mapping, bytes);
+			goto done;
+		}
+		memcpy(m->name, e->name, MATRIX_NAME_LEN);
+		m->rows = e->rows;
+		m->cols = e->cols;
+		m->stride = e->cols;
+		m->data = mapping;
+		m->refs = 1;
+		m->mapping = mapping;
+		m->mapping_len = bytes;
+		restored[mapped] = m;
+	}
+
+	for (unsigned int i = 0; i < header.count; ++i) {
+		if (add_matrix_to_array(mats, restored[i], num_mats) == -1) {
+			destroy_matrix(&restored[i]);
+			continue;
+		}
+		restored[i] = NULL;
+		++*loaded;
+	}
+	ok = true;
+
+done:
+	if (!ok) {
+		for (unsigned int i = 0; i < mapped; ++i) {
+			destroy_matrix(&restored[i]);
+		}
+	}
+	free(entries);
+	free(restored);
+	close(fd);
+	return ok;
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: Rounds a size up to the image alignment
+	INPUT: bytes - the size
+	RETURN: The aligned size
+*/
+static size_t align_up (size_t bytes) {
+	return (bytes + SESSION_ALIGN - 1) / SESSION_ALIGN * SESSION_ALIGN;
+}
+
+/*
+	PURPOSE: Writes all of a buffer at an offset, retrying short writes
+	INPUT: fd - file to write
+		buf - bytes to write
+		len - number of bytes
+		offset - file offset of the first byte
+	RETURN: If everything was written returns true
+		else false
+*/
+static bool pwrite_full (int fd, const void* buf, size_t len, off_t offset) {
+	const unsigned char* in = buf;
+	while (len > 0) {
+		ssize_t put = pwrite(fd, in, len, offset);
+		if (put < 0 && errno == EINTR) {
+			continue;
+		}
+		if (put <= 0) {
+			return false;
+		}
+		in += put;
+		len -= put;
+		offset += put;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Writes a band of a matrix's rows into its image region.
+		Views are written row by row, whole matrices in one pwrite
+	INPUT: arg - the Session_Write_Args_t
+		row_begin, row_end - rows to write
+	RETURN: Nothing
+*/
+static void write_rows_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	Session_Write_Args_t* w = arg;
+	const Matrix_t* m = w->m;
+	const size_t row_bytes = (size_t) m->cols * sizeof(unsigned int);
+
+	for (unsigned int i = row_begin; i < row_end && !w->failed; ++i) {
+		const unsigned int rows = m->stride == m->cols ? row_end - i : 1;
+		if (!pwrite_full(w->fd, &m->data[(size_t) i * m->stride], rows * row_bytes,
+				w->data_offset + (off_t) i * row_bytes)) {
+			perror("FAILED TO WRITE SESSION MATRIX\n");
+			w->failed = true;
+		}
+		i += rows - 1;
+	}
+}
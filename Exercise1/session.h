@@ -0,0 +1,32 @@
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+/*
+ * A session image is one file: a Session_Header_t, then count
+ * Session_Entry_t, then each matrix's rows in row-major order starting at
+ * its own SESSION_ALIGN aligned offset so it can be mapped on its own.
+ */
+
+#define SESSION_MAGIC 0x5353544dU	/* "MTSS" */
+#define SESSION_VERSION 1
+/* covers 4K and 64K page systems */
+#define SESSION_ALIGN (64 << 10)
+
+typedef struct {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int count;		/* matrices in the image, in workspace order */
+	unsigned int align;		/* alignment of every data_offset */
+}Session_Header_t;
+
+typedef struct {
+	char name[MATRIX_NAME_LEN];
+	unsigned int rows;
+	unsigned int cols;
+	unsigned long long data_offset;
+}Session_Entry_t;
+
+bool save_session (const char* session_filename, Matrix_t** mats, unsigned int num_mats);
+bool load_session (const char* session_filename, Matrix_t** mats, unsigned int num_mats, unsigned int* loaded);
+
+#endif
@@ -0,0 +1,1084 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "command.h"
+#include "matrix.h"
+#include "arith.h"
+#include "parallel.h"
+#include "shard.h"
+#include "trace.h"
+
+/*
+ * The coordinator only keeps the layout of a sharded matrix. Each operation
+ * runs in two phases: one request is sent to every worker, and then every
+ * reply is collected. The workers therefore run their part at the same
+ * time, each with its own address space, allocator and share of the cpus.
+ * Requests go over one socketpair per worker. A request is a
+ * Shard_Request_t followed by the shard's rows for a scatter. A reply is a
+ * Shard_Reply_t followed by the shard's rows for a gather. Shard files are
+ * plain matrix files, one per worker, named <prefix>.<worker>.
+ */
+
+#define SHARD_MAX_WORKERS 64
+#define SHARD_MAX_MATRICES 64
+#define SHARD_PATH_LEN 1024
+
+typedef enum {
+	SHARD_CREATE,
+	SHARD_SCATTER,
+	SHARD_GATHER,
+	SHARD_READ,
+	SHARD_WRITE,
+	SHARD_LOAD,
+	SHARD_ADD,
+	SHARD_SHIFT,
+	SHARD_SUM,
+	SHARD_EQUAL,
+	SHARD_DROP
+}Shard_Op_t;
+
+typedef struct {
+	unsigned int op;
+	unsigned int rows;		/* shard dimensions for CREATE, SCATTER and GATHER */
+	unsigned int cols;
+	unsigned int row_begin;		/* rows of the file READ loads */
+	unsigned int row_end;
+	unsigned int shift;
+	char direction;
+	char names[3][MATRIX_NAME_LEN];
+	char path[SHARD_PATH_LEN];
+}Shard_Request_t;
+
+typedef struct {
+	unsigned int ok;
+	unsigned int rows;
+	unsigned int cols;
+	unsigned long long value;	/* SUM total, EQUAL result */
+}Shard_Reply_t;
+
+typedef struct {
+	char name[MATRIX_NAME_LEN];
+	unsigned int rows;
+	unsigned int cols;
+	unsigned int row_begin[SHARD_MAX_WORKERS + 1];	/* shard k is rows [row_begin[k], row_begin[k + 1]) */
+}Shard_Matrix_t;
+
+typedef struct {
+	Shard_Request_t request;
+	const unsigned int* send_rows;	/* SCATTER rows, send_stride apart */
+	unsigned int send_stride;
+	unsigned int* recv_rows;	/* where GATHER rows go, recv_stride apart */
+	unsigned int recv_stride;
+	Shard_Reply_t reply;
+	bool failed;
+}Shard_Call_t;
+
+static int worker_fds[SHARD_MAX_WORKERS];
+static pid_t worker_pids[SHARD_MAX_WORKERS];
+static unsigned int num_shard_workers = 0;
+static Shard_Matrix_t* sharded[SHARD_MAX_MATRICES];
+
+/*protected functions*/
+static bool shard_start (void);
+static void shard_child_fork (void);
+static void close_inherited_fds (int keep);
+static void shard_worker (int fd);
+static bool worker_store (Matrix_t** shards, Matrix_t* m);
+static Matrix_t** worker_find (Matrix_t** shards, const char* name);
+static bool drain (int fd, size_t len);
+static Shard_Call_t* new_calls (Shard_Op_t op, const char* name);
+static bool shard_call (Shard_Call_t* calls, const char* op, const char* name);
+static void send_band (void* arg, unsigned int worker_begin, unsigned int worker_end);
+static void recv_band (void* arg, unsigned int worker_begin, unsigned int worker_end);
+static void drop_everywhere (const char* name);
+static Shard_Matrix_t* find_sharded (const char* name);
+static bool add_sharded (const char* name, unsigned int rows, unsigned int cols, const unsigned int* row_begin);
+static void split_rows (unsigned int rows, unsigned int* row_begin);
+static bool same_layout (const Shard_Matrix_t* a, const Shard_Matrix_t* b);
+static bool new_sharded_name (const char* name);
+static bool send_full (int fd, const void* buf, size_t len);
+static bool recv_full (int fd, void* buf, size_t len);
+
+/*
+	PURPOSE: Splits a matrix into row shards, one per worker
+	INPUT: m - the matrix, left as it is
+		name - name of the sharded matrix
+	RETURN: If successful returns true
+		else false
+*/
+bool shard_scatter (Matrix_t* m, const char* name) {
+
+	if (!m || !m->data)
+	{
+		printf("No matrix and/or data!\n");
+		return false;
+	}
+	if (!new_sharded_name(name) || !shard_start()) {
+		return false;
+	}
+	if (m->rows < num_shard_workers)
+	{
+		printf("Matrix needs at least one row for each of the %u workers!\n", num_shard_workers);
+		return false;
+	}
+
+	unsigned int row_begin[SHARD_MAX_WORKERS + 1];
+	split_rows(m->rows, row_begin);
+	Shard_Call_t* calls = new_calls(SHARD_SCATTER, name);
+	if (!calls) {
+		return false;
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		calls[k].request.rows = row_begin[k + 1] - row_begin[k];
+		calls[k].request.cols = m->cols;
+		calls[k].send_rows = &m->data[(size_t) row_begin[k] * m->stride];
+		calls[k].send_stride = m->stride;
+	}
+	bool ok = shard_call(calls, "shard:scatter", name);
+	free(calls);
+	if (ok) {
+		ok = add_sharded(name, m->rows, m->cols, row_begin);
+	}
+	if (!ok) {
+		drop_everywhere(name);
+	}
+	return ok;
+}
+
+/*
+	PURPOSE: Collects every shard of a sharded matrix into a new matrix
+	INPUT: name - the sharded matrix
+		local_name - name of the new matrix
+		m - set to the new matrix, must point to NULL
+	RETURN: If successful returns true
+		else false
+*/
+bool shard_gather (const char* name, const char* local_name, Matrix_t** m) {
+
+	Shard_Matrix_t* s = find_sharded(name);
+	if (!s)
+	{
+		printf("No sharded matrix (%s)!\n", name);
+		return false;
+	}
+	if (!create_matrix_uninitialized(m, local_name, s->rows, s->cols)) {
+		return false;
+	}
+
+	Shard_Call_t* calls = new_calls(SHARD_GATHER, name);
+	if (!calls) {
+		destroy_matrix(m);
+		return false;
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		calls[k].request.rows = s->row_begin[k + 1] - s->row_begin[k];
+		calls[k].request.cols = s->cols;
+		calls[k].recv_rows = &(*m)->data[(size_t) s->row_begin[k] * (*m)->stride];
+		calls[k].recv_stride = (*m)->stride;
+	}
+	const bool ok = shard_call(calls, "shard:gather", name);
+	free(calls);
+	if (!ok) {
+		destroy_matrix(m);
+	}
+	return ok;
+}
+
+/*
+	PURPOSE: Creates a zeroed sharded matrix
+	INPUT: name - name of the sharded matrix
+		rows, cols - its dimensions
+	RETURN: If successful returns true
+		else false
+*/
+bool shard_create (const char* name, unsigned int rows, unsigned int cols) {
+
+	if (!new_sharded_name(name) || !shard_start()) {
+		return false;
+	}
+	if (rows < num_shard_workers || cols == 0)
+	{
+		printf("Matrix needs at least one row for each of the %u workers!\n", num_shard_workers);
+		return false;
+	}
+
+	unsigned int row_begin[SHARD_MAX_WORKERS + 1];
+	split_rows(rows, row_begin);
+	Shard_Call_t* calls = new_calls(SHARD_CREATE, name);
+	if (!calls) {
+		return false;
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		calls[k].request.rows = row_begin[k + 1] - row_begin[k];
+		calls[k].request.cols = cols;
+	}
+	bool ok = shard_call(calls, "shard:create", name);
+	free(calls);
+	if (ok) {
+		ok = add_sharded(name, rows, cols, row_begin);
+	}
+	if (!ok) {
+		drop_everywhere(name);
+	}
+	return ok;
+}
+
+/*
+	PURPOSE: Loads a matrix file as a sharded matrix, every worker reading
+		only its own row range of the file
+	INPUT: matrix_input_filename - the matrix file
+		name - name of the sharded matrix
+	RETURN: If successful returns true
+		else false
+*/
+bool shard_read (const char* matrix_input_filename, const char* name) {
+
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	if (!new_sharded_name(name) || !read_matrix_dims(matrix_input_filename, &rows, &cols) || !shard_start()) {
+		return false;
+	}
+	if (strlen(matrix_input_filename) + 1 > SHARD_PATH_LEN)
+	{
+		printf("Filename is too long!\n");
+		return false;
+	}
+	if (rows < num_shard_workers)
+	{
+		printf("Matrix needs at least one row for each of the %u workers!\n", num_shard_workers);
+		return false;
+	}
+
+	unsigned int row_begin[SHARD_MAX_WORKERS + 1];
+	split_rows(rows, row_begin);
+	Shard_Call_t* calls = new_calls(SHARD_READ, name);
+	if (!calls) {
+		return false;
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		calls[k].request.row_begin = row_begin[k];
+		calls[k].request.row_end = row_begin[k + 1];
+		strcpy(calls[k].request.path, matrix_input_filename);
+	}
+	bool ok = shard_call(calls, "shard:read", name);
+	for (unsigned int k = 0; ok && k < num_shard_workers; ++k) {
+		ok = calls[k].reply.rows == row_begin[k + 1] - row_begin[k] && calls[k].reply.cols == cols;
+	}
+	free(calls);
+	if (ok) {
+		ok = add_sharded(name, rows, cols, row_begin);
+	}
+	if (!ok) {
+		drop_everywhere(name);
+	}
+	return ok;
+}
+
+/*
+	PURPOSE: Writes every shard to its own matrix file, <prefix>.<worker>
+	INPUT: name - the sharded matrix
+		prefix - start of the shard file names
+	RETURN: If successful returns true
+		else false
+*/
+bool shard_write (const char* name, const char* prefix) {
+
+	if (!find_sharded(name))
+	{
+		printf("No sharded matrix (%s)!\n", name);
+		return false;
+	}
+	if (!prefix || strlen(prefix) + 8 > SHARD_PATH_LEN)
+	{
+		printf("Shard file prefix is missing or too long!\n");
+		return false;
+	}
+
+	Shard_Call_t* calls = new_calls(SHARD_WRITE, name);
+	if (!calls) {
+		return false;
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		snprintf(calls[k].request.path, SHARD_PATH_LEN, "%s.%u", prefix, k);
+	}
+	const bool ok = shard_call(calls, "shard:write", name);
+	free(calls);
+	return ok;
+}
+
+/*
+	PURPOSE: Loads shard files written by shard_write, worker k reading
+		<prefix>.<k>. The shards may have any number of rows but the
+		same number of cols
+	INPUT: prefix - start of the shard file names
+		name - name of the sharded matrix
+	RETURN: If successful returns true
+		else false
+*/
+bool shard_load (const char* prefix, const char* name) {
+
+	if (!prefix || strlen(prefix) + 8 > SHARD_PATH_LEN)
+	{
+		printf("Shard file prefix is missing or too long!\n");
+		return false;
+	}
+	if (!new_sharded_name(name) || !shard_start()) {
+		return false;
+	}
+
+	Shard_Call_t* calls = new_calls(SHARD_LOAD, name);
+	if (!calls) {
+		return false;
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		snprintf(calls[k].request.path, SHARD_PATH_LEN, "%s.%u", prefix, k);
+	}
+	bool ok = shard_call(calls, "shard:load", name);
+	unsigned int row_begin[SHARD_MAX_WORKERS + 1];
+	row_begin[0] = 0;
+	for (unsigned int k = 0; ok && k < num_shard_workers; ++k) {
+		row_begin[k + 1] = row_begin[k] + calls[k].reply.rows;
+		if (calls[k].reply.cols != calls[0].reply.cols || row_begin[k + 1] < row_begin[k]) {
+			printf("Shard files of %s don't fit together!\n", prefix);
+			ok = false;
+		}
+	}
+	if (ok) {
+		ok = add_sharded(name, row_begin[num_shard_workers], calls[0].reply.cols, row_begin);
+	}
+	free(calls);
+	if (!ok) {
+		drop_everywhere(name);
+	}
+	return ok;
+}
+
+/*
+	PURPOSE: Adds two sharded matrices shard by shard into c. An existing c
+		is written into, even if it is a or b
+	INPUT: a, b - the sharded matrices to add, with the same layout
+		c - the sharded result
+	RETURN: If successful returns true
+		else false
+*/
+bool shard_add (const char* a, const char* b, const char* c) {
+
+	Shard_Matrix_t* sa = find_sharded(a);
+	Shard_Matrix_t* sb = find_sharded(b);
+	Shard_Matrix_t* sc = find_sharded(c);
+	if (!sa || !sb)
+	{
+		printf("No sharded matrix (%s)!\n", sa ? b : a);
+		return false;
+	}
+	if (!same_layout(sa, sb) || (sc && !same_layout(sa, sc)))
+	{
+		printf("Sharded matrices must have the same dimensions and shards!\n");
+		return false;
+	}
+	if (!sc && !new_sharded_name(c)) {
+		return false;
+	}
+
+	Shard_Call_t* calls = new_calls(SHARD_ADD, a);
+	if (!calls) {
+		return false;
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		strcpy(calls[k].request.names[1], b);
+		strcpy(calls[k].request.names[2], c);
+	}
+	bool ok = shard_call(calls, "shard:add", c);
+	free(calls);
+	if (!sc) {
+		if (ok) {
+			ok = add_sharded(c, sa->rows, sa->cols, sa->row_begin);
+		}
+		if (!ok) {
+			drop_everywhere(c);
+		}
+	}
+	return ok;
+}
+
+/*
+	PURPOSE: Bit shifts every shard of a sharded matrix
+	INPUT: name - the sharded matrix
+		direction - l or r
+		shift - number of positions
+	RETURN: If successful returns true
+		else false
+*/
+bool shard_shift (const char* name, char direction, unsigned int shift) {
+
+	if (!find_sharded(name))
+	{
+		printf("No sharded matrix (%s)!\n", name);
+		return false;
+	}
+
+	Shard_Call_t* calls = new_calls(SHARD_SHIFT, name);
+	if (!calls) {
+		return false;
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		calls[k].request.direction = direction;
+		calls[k].request.shift = shift;
+	}
+	const bool ok = shard_call(calls, "shard:shift", name);
+	free(calls);
+	return ok;
+}
+
+/*
+	PURPOSE: Adds up every element of a sharded matrix
+	INPUT: name - the sharded matrix
+		sum - set to the 64 bit sum
+	RETURN: If successful returns true
+		else false
+*/
+bool shard_sum (const char* name, unsigned long long* sum) {
+
+	if (!find_sharded(name))
+	{
+		printf("No sharded matrix (%s)!\n", name);
+		return false;
+	}
+
+	Shard_Call_t* calls = new_calls(SHARD_SUM, name);
+	if (!calls) {
+		return false;
+	}
+	const bool ok = shard_call(calls, "shard:sum", name);
+	*sum = 0;
+	for (unsigned int k = 0; ok && k < num_shard_workers; ++k) {
+		*sum += calls[k].reply.value;
+	}
+	free(calls);
+	return ok;
+}
+
+/*
+	PURPOSE: Compares two sharded matrices shard by shard
+	INPUT: a, b - the sharded matrices
+		equal - set to whether every element matches
+	RETURN: If the comparison ran returns true
+		else false
+*/
+bool shard_equal (const char* a, const char* b, bool* equal) {
+
+	Shard_Matrix_t* sa = find_sharded(a);
+	Shard_Matrix_t* sb = find_sharded(b);
+	if (!sa || !sb)
+	{
+		printf("No sharded matrix (%s)!\n", sa ? b : a);
+		return false;
+	}
+	*equal = false;
+	if (sa->rows != sb->rows || sa->cols != sb->cols) {
+		return true;
+	}
+	if (!same_layout(sa, sb))
+	{
+		printf("Sharded matrices must have the same shards!\n");
+		return false;
+	}
+
+	Shard_Call_t* calls = new_calls(SHARD_EQUAL, a);
+	if (!calls) {
+		return false;
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		strcpy(calls[k].request.names[1], b);
+	}
+	const bool ok = shard_call(calls, "shard:equal", a);
+	*equal = ok;
+	for (unsigned int k = 0; ok && k < num_shard_workers; ++k) {
+		*equal = *equal && calls[k].reply.value;
+	}
+	free(calls);
+	return ok;
+}
+
+/*
+	PURPOSE: Frees every shard of a sharded matrix
+	INPUT: name - the sharded matrix
+	RETURN: If successful returns true
+		else false
+*/
+bool shard_drop (const char* name) {
+
+	for (unsigned int i = 0; i < SHARD_MAX_MATRICES; ++i) {
+		if (sharded[i] && strcmp(sharded[i]->name, name) == 0) {
+			drop_everywhere(name);
+			free(sharded[i]);
+			sharded[i] = NULL;
+			return true;
+		}
+	}
+	printf("No sharded matrix (%s)!\n", name);
+	return false;
+}
+
+/*
+	PURPOSE: Stops the workers, dropping every sharded matrix
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+void shard_shutdown (void) {
+
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		if (worker_fds[k] >= 0) {
+			close(worker_fds[k]);
+		}
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		waitpid(worker_pids[k], NULL, 0);
+	}
+	num_shard_workers = 0;
+	for (unsigned int i = 0; i < SHARD_MAX_MATRICES; ++i) {
+		free(sharded[i]);
+		sharded[i] = NULL;
+	}
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: Forks the workers on first use. Worker k gets share k of the
+		thread pool's cpus, which are laid out node by node
+	INPUT: Nothing
+	RETURN: If the workers are running returns true
+		else false
+*/
+static bool shard_start (void) {
+	static bool registered = false;
+
+	if (num_shard_workers > 0) {
+		return true;
+	}
+	unsigned int count = parallel_numa_nodes();
+	const char* env = getenv("MATLAB_SHARDS");
+	if (env && atoi(env) > 0) {
+		count = atoi(env);
+	}
+	else if (count < 2) {
+		count = 2;
+	}
+	if (count > SHARD_MAX_WORKERS) {
+		count = SHARD_MAX_WORKERS;
+	}
+	if (!registered) {
+		pthread_atfork(NULL, NULL, shard_child_fork);
+		registered = true;
+	}
+
+	fflush(NULL);
+	for (unsigned int k = 0; k < count; ++k) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+			perror("FAILED TO CREATE SHARD SOCKETS\n");
+			shard_shutdown();
+			return false;
+		}
+		const pid_t pid = fork();
+		if (pid < 0) {
+			perror("FAILED TO FORK SHARD WORKER\n");
+			close(fds[0]);
+			close(fds[1]);
+			shard_shutdown();
+			return false;
+		}
+		if (pid == 0) {
+			close_inherited_fds(fds[1]);
+			trace_detach();
+			parallel_restrict(k, count);
+			shard_worker(fds[1]);
+			_exit(0);
+		}
+		close(fds[1]);
+		worker_fds[k] = fds[0];
+		worker_pids[k] = pid;
+		num_shard_workers = k + 1;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: A forked child doesn't own the parent's workers. It closes
+		its copies of their sockets and starts its own on first use
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+static void shard_child_fork (void) {
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		if (worker_fds[k] >= 0) {
+			close(worker_fds[k]);
+		}
+	}
+	num_shard_workers = 0;
+	for (unsigned int i = 0; i < SHARD_MAX_MATRICES; ++i) {
+		free(sharded[i]);
+		sharded[i] = NULL;
+	}
+}
+
+/*
+	PURPOSE: Closes everything a shard worker inherited, the listening
+		socket, epoll fd, clients and record or trace files included,
+		leaving only stdin, stdout, stderr and its own socket
+	INPUT: keep - the worker's end of the socketpair
+	RETURN: Nothing
+*/
+static void close_inherited_fds (int keep) {
+	DIR* dir = opendir("/proc/self/fd");
+	if (!dir) {
+		const long max_fd = sysconf(_SC_OPEN_MAX);
+		for (long fd = 3; fd < max_fd; ++fd) {
+			if (fd != keep) {
+				close(fd);
+			}
+		}
+		return;
+	}
+	struct dirent* entry;
+	while ((entry = readdir(dir))) {
+		const int fd = atoi(entry->d_name);
+		if (entry->d_name[0] != '.' && fd > 2 && fd != keep && fd != dirfd(dir)) {
+			close(fd);
+		}
+	}
+	closedir(dir);
+}
+
+/*
+	PURPOSE: Worker loop, answers requests until the coordinator closes
+		its socket
+	INPUT: fd - the worker's end of the socketpair
+	RETURN: Nothing
+*/
+static void shard_worker (int fd) {
+	Matrix_t* shards[SHARD_MAX_MATRICES] = { NULL };
+	Shard_Request_t req;
+
+	while (recv_full(fd, &req, sizeof(req))) {
+		Shard_Reply_t reply = { 0, 0, 0, 0 };
+		for (unsigned int i = 0; i < 3; ++i) {
+			req.names[i][MATRIX_NAME_LEN - 1] = '\0';
+		}
+		req.path[SHARD_PATH_LEN - 1] = '\0';
+		Matrix_t** slot = worker_find(shards, req.names[0]);
+		Matrix_t* m = slot ? *slot : NULL;
+		Matrix_t* created = NULL;
+
+		switch (req.op) {
+		case SHARD_CREATE:
+			reply.ok = !m && create_matrix(&created, req.names[0], req.rows, req.cols)
+				&& worker_store(shards, created);
+			break;
+		case SHARD_SCATTER:
+			if (m || !create_matrix_uninitialized(&created, req.names[0], req.rows, req.cols)) {
+				/* the rows are on the way anyway */
+				if (!drain(fd, (size_t) req.rows * req.cols * sizeof(unsigned int))) {
+					goto done;
+				}
+				break;
+			}
+			if (!recv_full(fd, created->data, (size_t) req.rows * req.cols * sizeof(unsigned int))) {
+				destroy_matrix(&created);
+				goto done;
+			}
+			reply.ok = worker_store(shards, created);
+			break;
+		case SHARD_GATHER:
+			reply.ok = m && m->rows == req.rows && m->cols == req.cols;
+			break;
+		case SHARD_READ:
+			reply.ok = !m && read_matrix_rows(req.path, req.row_begin, req.row_end, &created);
+			if (reply.ok) {
+				memset(created->name, 0, MATRIX_NAME_LEN);
+				strcpy(created->name, req.names[0]);
+				reply.ok = worker_store(shards, created);
+			}
+			break;
+		case SHARD_LOAD:
+			reply.ok = !m && read_matrix(req.path, &created);
+			if (reply.ok) {
+				memset(created->name, 0, MATRIX_NAME_LEN);
+				strcpy(created->name, req.names[0]);
+				reply.ok = worker_store(shards, created);
+			}
+			break;
+		case SHARD_WRITE:
+			reply.ok = m && write_matrix(req.path, m);
+			break;
+		case SHARD_ADD: {
+			Matrix_t** b = worker_find(shards, req.names[1]);
+			Matrix_t** c = worker_find(shards, req.names[2]);
+			Matrix_t* dest = c ? *c : NULL;
+			if (!m || !b) {
+				break;
+			}
+			if (!dest && !create_matrix_uninitialized(&created, req.names[2], m->rows, m->cols)) {
+				break;
+			}
+			reply.ok = add_matrices(m, *b, dest ? dest : created) && (dest || worker_store(shards, created));
+			break;
+		}
+		case SHARD_SHIFT:
+			reply.ok = m && bitwise_shift_matrix(m, req.direction, req.shift);
+			break;
+		case SHARD_SUM:
+			reply.ok = m && sum_matrix(m, &reply.value);
+			break;
+		case SHARD_EQUAL: {
+			Matrix_t** b = worker_find(shards, req.names[1]);
+			reply.ok = m && b;
+			reply.value = reply.ok && equal_matrices(m, *b);
+			break;
+		}
+		case SHARD_DROP:
+			if (slot) {
+				destroy_matrix(slot);
+			}
+			reply.ok = true;
+			break;
+		}
+		if (!reply.ok && created) {
+			destroy_matrix(&created);
+		}
+		/* the reply carries the dimensions of the shard the op produced */
+		Matrix_t** result = worker_find(shards, req.names[req.op == SHARD_ADD ? 2 : 0]);
+		if (result && reply.ok) {
+			reply.rows = (*result)->rows;
+			reply.cols = (*result)->cols;
+		}
+		if (!send_full(fd, &reply, sizeof(reply))) {
+			break;
+		}
+		if (req.op == SHARD_GATHER && reply.ok
+			&& !send_full(fd, (*result)->data, (size_t) reply.rows * reply.cols * sizeof(unsigned int))) {
+			break;
+		}
+	}
+
+done:
+	for (unsigned int i = 0; i < SHARD_MAX_MATRICES; ++i) {
+		if (shards[i]) {
+			destroy_matrix(&shards[i]);
+		}
+	}
+	close(fd);
+}
+
+/*
+	PURPOSE: Keeps a shard in the first free slot of a worker
+	INPUT: shards - the worker's shards
+		m - the new shard
+	RETURN: If there was room returns true
+		else false
+*/
+static bool worker_store (Matrix_t** shards, Matrix_t* m) {
+	for (unsigned int i = 0; i < SHARD_MAX_MATRICES; ++i) {
+		if (!shards[i]) {
+			shards[i] = m;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+	PURPOSE: Finds a worker's shard by name
+	INPUT: shards - the worker's shards
+		name - the name
+	RETURN: The slot holding the shard, NULL if there is none
+*/
+static Matrix_t** worker_find (Matrix_t** shards, const char* name) {
+	for (unsigned int i = 0; i < SHARD_MAX_MATRICES; ++i) {
+		if (shards[i] && strcmp(shards[i]->name, name) == 0) {
+			return &shards[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+	PURPOSE: Reads and throws away bytes nobody wants
+	INPUT: fd - where the bytes come from
+		len - number of bytes
+	RETURN: If all bytes arrived returns true
+		else false
+*/
+static bool drain (int fd, size_t len) {
+	char buf[4096];
+	while (len > 0) {
+		const size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+		if (!recv_full(fd, buf, chunk)) {
+			return false;
+		}
+		len -= chunk;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: One request per worker, all the same op on the same matrix
+	INPUT: op - the op
+		name - the first matrix of every request
+	RETURN: The requests, NULL if out of memory
+*/
+static Shard_Call_t* new_calls (Shard_Op_t op, const char* name) {
+	Shard_Call_t* calls = calloc(num_shard_workers ? num_shard_workers : 1, sizeof(Shard_Call_t));
+	if (!calls) {
+		return NULL;
+	}
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		calls[k].request.op = op;
+		strcpy(calls[k].request.names[0], name);
+	}
+	return calls;
+}
+
+/*
+	PURPOSE: Sends every worker its request, then collects every reply
+	INPUT: calls - one per worker
+		op, name - labels for the trace spans
+	RETURN: If every worker succeeded returns true
+		else false
+*/
+static bool shard_call (Shard_Call_t* calls, const char* op, const char* name) {
+	if (num_shard_workers == 0) {
+		return false;
+	}
+	trace_begin(op, name, num_shard_workers, 0);
+	parallel_for_rows(op, name, num_shard_workers, 0, 1, send_band, calls);
+	parallel_for_rows(op, name, num_shard_workers, 0, 1, recv_band, calls);
+	trace_end(op, name);
+
+	bool ok = true;
+	for (unsigned int k = 0; k < num_shard_workers; ++k) {
+		if (calls[k].failed || !calls[k].reply.ok) {
+			printf("Shard worker %u failed to %s %s\n", k, op + strlen("shard:"), name);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+/*
+	PURPOSE: Sends the requests of a band of workers, with the rows of a
+		scatter. A worker whose socket fails is not used again
+	INPUT: arg - the Shard_Call_t array
+		worker_begin, worker_end - workers of the band
+	RETURN: Nothing
+*/
+static void send_band (void* arg, unsigned int worker_begin, unsigned int worker_end) {
+	Shard_Call_t* calls = arg;
+
+	for (unsigned int k = worker_begin; k < worker_end; ++k) {
+		Shard_Call_t* c = &calls[k];
+		bool sent = worker_fds[k] >= 0 && send_full(worker_fds[k], &c->request, sizeof(c->request));
+		if (sent && c->request.op == SHARD_SCATTER) {
+			const size_t row_bytes = (size_t) c->request.cols * sizeof(unsigned int);
+			if (c->send_stride == c->request.cols) {
+				sent = send_full(worker_fds[k], c->send_rows, row_bytes * c->request.rows);
+			}
+			for (unsigned int i = 0; sent && c->send_stride != c->request.cols && i < c->request.rows; ++i) {
+				sent = send_full(worker_fds[k], &c->send_rows[(size_t) i * c->send_stride], row_bytes);
+			}
+		}
+		if (!sent) {
+			c->failed = true;
+			if (worker_fds[k] >= 0) {
+				close(worker_fds[k]);
+				worker_fds[k] = -1;
+			}
+		}
+	}
+}
+
+/*
+	PURPOSE: Collects the replies of a band of workers, with the rows of a
+		gather
+	INPUT: arg - the Shard_Call_t array
+		worker_begin, worker_end - workers of the band
+	RETURN: Nothing
+*/
+static void recv_band (void* arg, unsigned int worker_begin, unsigned int worker_end) {
+	Shard_Call_t* calls = arg;
+
+	for (unsigned int k = worker_begin; k < worker_end; ++k) {
+		Shard_Call_t* c = &calls[k];
+		if (c->failed) {
+			continue;
+		}
+		bool received = recv_full(worker_fds[k], &c->reply, sizeof(c->reply));
+		if (received && c->request.op == SHARD_GATHER && c->reply.ok) {
+			const size_t row_bytes = (size_t) c->request.cols * sizeof(unsigned int);
+			for (unsigned int i = 0; received && i < c->request.rows; ++i) {
+				received = recv_full(worker_fds[k], &c->recv_rows[(size_t) i * c->recv_stride], row_bytes);
+			}
+		}
+		if (!received) {
+			c->failed = true;
+			close(worker_fds[k]);
+			worker_fds[k] = -1;
+		}
+	}
+}
+
+/*
+	PURPOSE: Frees a matrix's shards on every worker that has them, for
+		cleaning up after a failed operation
+	INPUT: name - the sharded matrix
+	RETURN: Nothing
+*/
+static void drop_everywhere (const char* name) {
+	Shard_Call_t* calls = new_calls(SHARD_DROP, name);
+	if (calls) {
+		parallel_for_rows("shard:drop", name, num_shard_workers, 0, 1, send_band, calls);
+		parallel_for_rows("shard:drop", name, num_shard_workers, 0, 1, recv_band, calls);
+		free(calls);
+	}
+}
+
+/*
+	PURPOSE: Finds the layout of a sharded matrix
+	INPUT: name - the name
+	RETURN: The layout, NULL if there is none
+*/
+static Shard_Matrix_t* find_sharded (const char* name) {
+	for (unsigned int i = 0; name && i < SHARD_MAX_MATRICES; ++i) {
+		if (sharded[i] && strcmp(sharded[i]->name, name) == 0) {
+			return sharded[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+	PURPOSE: Remembers the layout of a new sharded matrix
+	INPUT: name - the name
+		rows, cols - the dimensions
+		row_begin - first row of every shard, then rows
+	RETURN: If there was room returns true
+		else false
+*/
+static bool add_sharded (const char* name, unsigned int rows, unsigned int cols, const unsigned int* row_begin) {
+	for (unsigned int i = 0; i < SHARD_MAX_MATRICES; ++i) {
+		if (!sharded[i]) {
+			sharded[i] = calloc(1, sizeof(Shard_Matrix_t));
+			if (!sharded[i]) {
+				return false;
+			}
+			strcpy(sharded[i]->name, name);
+			sharded[i]->rows = rows;
+			sharded[i]->cols = cols;
+			memcpy(sharded[i]->row_begin, row_begin, (num_shard_workers + 1) * sizeof(unsigned int));
+			return true;
+		}
+	}
+	printf("Too many sharded matrices!\n");
+	return false;
+}
+
+/*
+	PURPOSE: Splits rows into one contiguous range per worker
+	INPUT: rows - number of rows
+		row_begin - set to the first row of every range, then rows
+	RETURN: Nothing
+*/
+static void split_rows (unsigned int rows, unsigned int* row_begin) {
+	for (unsigned int k = 0; k <= num_shard_workers; ++k) {
+		row_begin[k] = (unsigned long long) rows * k / num_shard_workers;
+	}
+}
+
+/*
+	PURPOSE: Checks if two sharded matrices are split the same way
+	INPUT: a, b - the layouts
+	RETURN: If shard k of both holds the same rows returns true
+		else false
+*/
+static bool same_layout (const Shard_Matrix_t* a, const Shard_Matrix_t* b) {
+	return a->rows == b->rows && a->cols == b->cols
+		&& memcmp(a->row_begin, b->row_begin, (num_shard_workers + 1) * sizeof(unsigned int)) == 0;
+}
+
+/*
+	PURPOSE: Checks a name is free for a new sharded matrix
+	INPUT: name - the name
+	RETURN: If it can be used returns true
+		else false
+*/
+static bool new_sharded_name (const char* name) {
+	if (!name || name[0] == '\0' || strlen(name) + 1 > MATRIX_NAME_LEN)
+	{
+		printf("No name for new matrix!\n");
+		return false;
+	}
+	if (find_sharded(name))
+	{
+		printf("Sharded matrix (%s) exists!\n", name);
+		return false;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Writes all of a buffer to a socket
+	INPUT: fd - where the bytes go
+		buf - bytes to write
+		len - number of bytes
+	RETURN: If everything was written returns true
+		else false
+*/
+static bool send_full (int fd, const void* buf, size_t len) {
+	const char* p = buf;
+	while (len > 0) {
+		ssize_t sent = send(fd, p, len, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sent <= 0) {
+			return false;
+		}
+		p += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Reads exactly len bytes from a socket
+	INPUT: fd - where the bytes come from
+		buf - where the bytes go
+		len - number of bytes
+	RETURN: If all bytes arrived returns true
+		else false
+*/
+static bool recv_full (int fd, void* buf, size_t len) {
+	char* p = buf;
+	while (len > 0) {
+		ssize_t got = recv(fd, p, len, 0);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			return false;
+		}
+		p += got;
+		len -= got;
+	}
+	return true;
+}
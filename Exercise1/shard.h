@@ -0,0 +1,23 @@
+#ifndef _SHARD_H_
+#define _SHARD_H_
+
+/*
+ * A sharded matrix is split into contiguous row shards, shard k living in
+ * worker process k. The workers are forked on first use, MATLAB_SHARDS of
+ * them, by default one per NUMA node and at least 2.
+ */
+
+bool shard_scatter (Matrix_t* m, const char* name);
+bool shard_gather (const char* name, const char* local_name, Matrix_t** m);
+bool shard_create (const char* name, unsigned int rows, unsigned int cols);
+bool shard_read (const char* matrix_input_filename, const char* name);
+bool shard_write (const char* name, const char* prefix);
+bool shard_load (const char* prefix, const char* name);
+bool shard_add (const char* a, const char* b, const char* c);
+bool shard_shift (const char* name, char direction, unsigned int shift);
+bool shard_sum (const char* name, unsigned long long* sum);
+bool shard_equal (const char* a, const char* b, bool* equal);
+bool shard_drop (const char* name);
+void shard_shutdown (void);
+
+#endif
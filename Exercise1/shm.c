@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrix.h"
+#include "parallel.h"
+#include "shm.h"
+
+/*
+ * publish moves a matrix into a POSIX shared memory segment. The data is
+ * copied there once and the matrix keeps living in the segment, so other
+ * processes that map it see every later change and publishing again costs
+ * nothing. attach maps a segment copy-on-write. Nothing is read until it
+ * is used, and changes made by this process stay private.
+ */
+
+#define SHM_NAME_MAX 255
+
+typedef struct {
+	const unsigned int* src;
+	unsigned int src_stride;
+	unsigned int* dest;
+	unsigned int cols;
+}Shm_Copy_Args_t;
+
+/*protected functions*/
+static bool shm_path (const char* shm_name, char* path);
+static void copy_rows_band (void* arg, unsigned int row_begin, unsigned int row_end);
+
+/*
+	PURPOSE: Moves a matrix into a named shared memory segment other
+		processes can map read-only
+	INPUT: m - matrix to publish, must own its data and have no views
+		shm_name - name of the segment, a leading / is added if missing
+	RETURN: If successful returns true
+		else false
+*/
+bool publish_matrix (Matrix_t* m, const char* shm_name) {
+
+	if (!m || !m->data)
+	{
+		printf("No matrix and/or data!\n");
+		return false;
+	}
+	char path[SHM_NAME_MAX + 2];
+	if (!shm_path(shm_name, path))
+	{
+		printf("Shared memory name is missing or too long!\n");
+		return false;
+	}
+	if (m->shm_name)
+	{
+		if (strcmp(m->shm_name, path) == 0) {
+			return true;
+		}
+		printf("Matrix (%s) is already published as %s\n", m->name, m->shm_name);
+		return false;
+	}
+	if (m->parent || m->refs > 1)
+	{
+		printf("Views and matrices with views can't be published, duplicate them first!\n");
+		return false;
+	}
+
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t data_offset = (sizeof(Shm_Matrix_Header_t) + page - 1) / page * page;
+	const size_t len = data_offset + (size_t) m->rows * m->cols * sizeof(unsigned int);
+
+	int fd = shm_open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		printf("FAILED TO CREATE SHARED MEMORY %s\n", path);
+		if (errno == EEXIST) {
+			perror("SHARED MEMORY ALREADY EXISTS\n");
+		}
+		else if (errno == EACCES) {
+			perror("DO NOT HAVE ACCESS TO SHARED MEMORY\n");
+		}
+		return false;
+	}
+	/* reserve every page now, a full /dev/shm fails here instead of
+	 * with SIGBUS halfway through the copy */
+	const int err = posix_fallocate(fd, 0, len);
+	void* mapping = err ? MAP_FAILED : mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		printf("FAILED TO SIZE SHARED MEMORY %s: %s\n", path, strerror(err ? err : errno));
+		shm_unlink(path);
+		return false;
+	}
+	char* shm_name_copy = strdup(path);
+	if (!shm_name_copy) {
+		munmap(mapping, len);
+		shm_unlink(path);
+		return false;
+	}
+
+	Shm_Matrix_Header_t* header = mapping;
+	header->version = SHM_MATRIX_VERSION;
+	header->rows = m->rows;
+	header->cols = m->cols;
+	header->data_offset = data_offset;
+	memcpy(header->name, m->name, MATRIX_NAME_LEN);
+
+	Shm_Copy_Args_t args = { m->data, m->stride, (unsigned int*) ((char*) mapping + data_offset), m->cols };
+	parallel_for_rows("publish", m->name, m->rows, m->cols, PARALLEL_MIN_BAND_ROWS, copy_rows_band, &args);
+	/* readers check the magic last so they never see a half copied matrix */
+	__sync_synchronize();
+	header->magic = SHM_MATRIX_MAGIC;
+
+	if (m->mapping) {
+		munmap(m->mapping, m->mapping_len);
+	}
+	else {
+		free(m->data);
+	}
+	m->data = args.dest;
+	m->stride = m->cols;
+	m->mapping = mapping;
+	m->mapping_len = len;
+	m->shm_name = shm_name_copy;
+	return true;
+}
+
+/*
+	PURPOSE: Maps a published matrix without copying it. Changes made to
+		the attached matrix are private to this process
+	INPUT: shm_name - name of the segment, a leading / is added if missing
+		name - name of the new matrix, NULL keeps the published name
+		m - pointer to the new matrix, must point to NULL
+	RETURN: If successful returns true
+		else false
+*/
+bool attach_matrix (const char* shm_name, const char* name, Matrix_t** m) {
+
+	if (!m || *m)
+	{
+		printf("Matrix exists!\n");
+		return false;
+	}
+	char path[SHM_NAME_MAX + 2];
+	if (!shm_path(shm_name, path))
+	{
+		printf("Shared memory name is missing or too long!\n");
+		return false;
+	}
+	if (name && strlen(name) + 1 > MATRIX_NAME_LEN)
+	{
+		printf("No name for new matrix!\n");
+		return false;
+	}
+
+	int fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		printf("FAILED TO OPEN SHARED MEMORY %s\n", path);
+		if (errno == ENOENT) {
+			perror("SHARED MEMORY DOES NOT EXIST\n");
+		}
+		else if (errno == EACCES) {
+			perror("DO NOT HAVE ACCESS TO SHARED MEMORY\n");
+		}
+		return false;
+	}
+	struct stat st;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(Shm_Matrix_Header_t)) {
+		mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		printf("FAILED TO MAP SHARED MEMORY %s\n", path);
+		return false;
+	}
+
+	const Shm_Matrix_Header_t* header = mapping;
+	const size_t data_bytes = (size_t) header->rows * header->cols * sizeof(unsigned int);
+	if (header->magic != SHM_MATRIX_MAGIC || header->version != SHM_MATRIX_VERSION
+		|| header->rows == 0 || header->cols == 0
+		|| header->data_offset < sizeof(Shm_Matrix_Header_t) || header->data_offset % sizeof(unsigned int)
+		|| header->data_offset > (size_t) st.st_size || (size_t) st.st_size - header->data_offset < data_bytes) {
+		printf("%s is not a published matrix\n", path);
+		munmap(mapping, st.st_size);
+		return false;
+	}
+
+	*m = calloc(1, sizeof(Matrix_t));
+	if (!(*m)) {
+		munmap(mapping, st.st_size);
+		return false;
+	}
+	if (name) {
+		memcpy((*m)->name, name, strlen(name) + 1);
+	}
+	else {
+		memcpy((*m)->name, header->name, MATRIX_NAME_LEN - 1);
+	}
+	(*m)->rows = header->rows;
+	(*m)->cols = header->cols;
+	(*m)->stride = header->cols;
+	(*m)->data = (unsigned int*) ((char*) mapping + header->data_offset);
+	(*m)->refs = 1;
+	(*m)->mapping = mapping;
+	(*m)->mapping_len = st.st_size;
+	return true;
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: Turns a segment name into the form shm_open expects
+	INPUT: shm_name - name given by the user
+		path - at least SHM_NAME_MAX + 2 bytes for the result
+	RETURN: If the name is usable returns true
+		else false
+*/
+static bool shm_path (const char* shm_name, char* path) {
+	if (!shm_name || shm_name[0] == '\0' || strlen(shm_name) > SHM_NAME_MAX) {
+		return false;
+	}
+	snprintf(path, SHM_NAME_MAX + 2, "%s%s", shm_name[0] == '/' ? "" : "/", shm_name);
+	return strchr(path + 1, '/') == NULL;
+}
+
+/*
+	PURPOSE: Copies a band of rows into the segment, one row band per
+		worker so the pages are first touched by the thread that fills them
+	INPUT: arg - the Shm_Copy_Args_t
+		row_begin, row_end - rows to copy
+	RETURN: Nothing
+*/
+static void copy_rows_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	const Shm_Copy_Args_t* args = arg;
+	for (unsigned int i = row_begin; i < row_end; ++i) {
+		memcpy(&args->dest[(size_t) i * args->cols], &args->src[(size_t) i * args->src_stride],
+			args->cols * sizeof(unsigned int));
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+/*
+ * Layout of a published matrix segment. Any process can shm_open the
+ * segment read-only, mmap it and find element (i, j) at
+ * data_offset + (i * cols + j) * sizeof(unsigned int) bytes from the start.
+ */
+
+#define SHM_MATRIX_MAGIC 0x4d54414dU	/* "MATM" */
+#define SHM_MATRIX_VERSION 1
+
+typedef struct {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int rows;
+	unsigned int cols;
+	unsigned long long data_offset;	/* page aligned so the data can be mapped alone */
+	char name[MATRIX_NAME_LEN];
+}Shm_Matrix_Header_t;
+
+bool publish_matrix (Matrix_t* m, const char* shm_name);
+bool attach_matrix (const char* shm_name, const char* name, Matrix_t** m);
+
+#endif
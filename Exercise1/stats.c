@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include <pthread.h>
+
+#include "command.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "stats.h"
+#include "trace.h"
+
+/*
+ * stats profiles the values of a matrix in one pass split into row bands.
+ * Every band keeps private counters, a log-linear histogram and HyperLogLog
+ * registers, and merges them into the totals once at its end. The
+ * histogram needs no range up front. Values below STATS_SUB_BUCKETS get
+ * their own bucket, and every power of two above is split into
+ * STATS_SUB_BUCKETS buckets, so a bucket is at most 1/16 of its values
+ * wide. Quantiles of big matrices are read off the histogram. Small
+ * matrices are also copied out during the pass and sorted for exact
+ * answers.
+ */
+
+/* 2^12 registers, the distinct estimate is off by about 1.04 / sqrt(4096) */
+#define STATS_HLL_BITS 12
+#define STATS_HLL_REGISTERS (1 << STATS_HLL_BITS)
+/* most lines the histogram is shown in */
+#define STATS_DISPLAY_ROWS 16
+#define STATS_BAR_WIDTH 40
+
+typedef struct {
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned __int128 sum_squares;
+	unsigned int min;
+	unsigned int max;
+	unsigned long long histogram[STATS_BUCKETS];
+	unsigned char registers[STATS_HLL_REGISTERS];
+}Stats_Partial_t;
+
+typedef struct {
+	const Matrix_t* m;
+	unsigned int* values;			/* copy of every value for exact answers, else NULL */
+	pthread_mutex_t lock;			/* guards total and failed */
+	Stats_Partial_t total;
+	bool failed;
+}Stats_Args_t;
+
+static const double quantile_points[STATS_QUANTILES] = { 0.01, 0.05, 0.25, 0.5, 0.75, 0.95, 0.99 };
+static const char* quantile_names[STATS_QUANTILES] = { "p1", "p5", "p25", "p50", "p75", "p95", "p99" };
+
+/*protected functions*/
+static unsigned int bucket_of (unsigned int value);
+static void bucket_range (unsigned int bucket, unsigned int* low, unsigned int* high);
+static unsigned long long hash_value (unsigned int value);
+static void stats_band (void* arg, unsigned int row_begin, unsigned int row_end);
+static void init_partial (Stats_Partial_t* p);
+static unsigned long long estimate_distinct (const unsigned char* registers);
+static unsigned int histogram_quantile (const Matrix_Stats_t* stats, double q);
+static int compare_values (const void* a, const void* b);
+
+/*
+	PURPOSE: Profiles the values of a matrix: min, max, mean, standard
+		deviation, a histogram, quantiles and the number of distinct values
+	INPUT: m - the matrix
+		stats - filled with the results
+	RETURN: If successful returns true
+		else false
+*/
+bool matrix_stats (Matrix_t* m, Matrix_Stats_t* stats) {
+
+	if (!m || !m->data || !stats)
+	{
+		printf("No matrix and/or data!\n");
+		return false;
+	}
+
+	Stats_Args_t* args = calloc(1, sizeof(Stats_Args_t));
+	if (!args) {
+		return false;
+	}
+	const size_t n = (size_t) m->rows * m->cols;
+	args->m = m;
+	pthread_mutex_init(&args->lock, NULL);
+	init_partial(&args->total);
+	/* without the copy the results are estimates, not a failure */
+	args->values = n <= STATS_EXACT_MAX ? malloc(n * sizeof(unsigned int)) : NULL;
+
+	trace_begin("stats", m->name, m->rows, m->cols);
+	parallel_for_rows("stats:band", m->name, m->rows, m->cols, PARALLEL_MIN_BAND_ROWS, stats_band, args);
+	if (args->failed) {
+		trace_end("stats", m->name);
+		printf("Out of memory for stats counters!\n");
+		pthread_mutex_destroy(&args->lock);
+		free(args->values);
+		free(args);
+		return false;
+	}
+
+	const Stats_Partial_t* t = &args->total;
+	memset(stats, 0, sizeof(Matrix_Stats_t));
+	stats->count = t->count;
+	stats->sum = t->sum;
+	stats->min = t->min;
+	stats->max = t->max;
+	const long double mean = (long double) t->sum / t->count;
+	const long double variance = (long double) t->sum_squares / t->count - mean * mean;
+	stats->mean = mean;
+	stats->stddev = variance > 0 ? sqrt(variance) : 0;
+	memcpy(stats->histogram, t->histogram, sizeof(stats->histogram));
+
+	if (args->values) {
+		qsort(args->values, n, sizeof(unsigned int), compare_values);
+		for (unsigned int q = 0; q < STATS_QUANTILES; ++q) {
+			const size_t rank = (size_t) ceil(quantile_points[q] * n);
+			stats->quantiles[q] = args->values[rank ? rank - 1 : 0];
+		}
+		stats->distinct = 1;
+		for (size_t i = 1; i < n; ++i) {
+			stats->distinct += args->values[i] != args->values[i - 1];
+		}
+		stats->exact = true;
+	}
+	else {
+		for (unsigned int q = 0; q < STATS_QUANTILES; ++q) {
+			stats->quantiles[q] = histogram_quantile(stats, quantile_points[q]);
+		}
+		stats->distinct = estimate_distinct(t->registers);
+		stats->exact = false;
+	}
+	trace_end("stats", m->name);
+
+	pthread_mutex_destroy(&args->lock);
+	free(args->values);
+	free(args);
+	return true;
+}
+
+/*
+	PURPOSE: Prints the results of matrix_stats
+	INPUT: name - name of the matrix
+		stats - the results
+		out - where to print them
+	RETURN: Nothing
+*/
+void display_stats (const char* name, const Matrix_Stats_t* stats, FILE* out) {
+	fprintf(out, "\nStats of (%s): %llu values\n", name, stats->count);
+	fprintf(out, "min %u  max %u  mean %.3f  stddev %.3f  sum %llu\n",
+		stats->min, stats->max, stats->mean, stats->stddev, stats->sum);
+	if (stats->exact) {
+		fprintf(out, "distinct %llu\n", stats->distinct);
+	}
+	else {
+		fprintf(out, "distinct ~%llu (HyperLogLog, about 1.6%% error)\n", stats->distinct);
+	}
+	fprintf(out, "quantiles (%s):", stats->exact ? "exact" : "within a histogram bucket");
+	for (unsigned int q = 0; q < STATS_QUANTILES; ++q) {
+		fprintf(out, " %s %u", quantile_names[q], stats->quantiles[q]);
+	}
+	fprintf(out, "\n");
+
+	/* shows the used buckets, joined into at most STATS_DISPLAY_ROWS lines */
+	const unsigned int first = bucket_of(stats->min);
+	const unsigned int last = bucket_of(stats->max);
+	const unsigned int per_row = (last - first) / STATS_DISPLAY_ROWS + 1;
+	unsigned long long peak = 0;
+	for (unsigned int b = first; b <= last; b += per_row) {
+		unsigned long long count = 0;
+		for (unsigned int k = b; k < b + per_row && k <= last; ++k) {
+			count += stats->histogram[k];
+		}
+		peak = count > peak ? count : peak;
+	}
+	fprintf(out, "histogram:\n");
+	for (unsigned int b = first; b <= last; b += per_row) {
+		unsigned int low;
+		unsigned int high;
+		unsigned int ignored;
+		unsigned long long count = 0;
+		const unsigned int end = b + per_row - 1 < last ? b + per_row - 1 : last;
+		for (unsigned int k = b; k <= end; ++k) {
+			count += stats->histogram[k];
+		}
+		bucket_range(b, &low, &ignored);
+		bucket_range(end, &ignored, &high);
+		low = low < stats->min ? stats->min : low;
+		high = high > stats->max ? stats->max : high;
+		const unsigned int bar = (unsigned int) (count * STATS_BAR_WIDTH / peak);
+		fprintf(out, "  [%u, %u] %llu ", low, high, count);
+		for (unsigned int i = 0; i < bar; ++i) {
+			fputc('#', out);
+		}
+		fputc('\n', out);
+	}
+	fprintf(out, "\n");
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: Histogram bucket of a value
+	INPUT: value - the value
+	RETURN: The bucket index
+*/
+static unsigned int bucket_of (unsigned int value) {
+	if (value < STATS_SUB_BUCKETS) {
+		return value;
+	}
+	/* the top bit picks the power of two, the next 4 bits the bucket in it */
+	const unsigned int top = 31 - __builtin_clz(value);
+	return (top - 3) * STATS_SUB_BUCKETS + ((value >> (top - 4)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/*
+	PURPOSE: Smallest and largest value of a bucket
+	INPUT: bucket - the bucket index
+		low, high - set to the bounds, both inclusive
+	RETURN: Nothing
+*/
+static void bucket_range (unsigned int bucket, unsigned int* low, unsigned int* high) {
+	if (bucket < STATS_SUB_BUCKETS) {
+		*low = *high = bucket;
+		return;
+	}
+	const unsigned int top = bucket / STATS_SUB_BUCKETS + 3;
+	const unsigned int sub = bucket % STATS_SUB_BUCKETS;
+	*low = (STATS_SUB_BUCKETS + sub) << (top - 4);
+	*high = *low + ((1U << (top - 4)) - 1);
+}
+
+/*
+	PURPOSE: Spreads a value over 64 bits for HyperLogLog
+	INPUT: value - the value
+	RETURN: The hash
+*/
+static unsigned long long hash_value (unsigned int value) {
+	unsigned long long x = value + 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+/*
+	PURPOSE: Sets up empty counters
+	INPUT: p - the counters
+	RETURN: Nothing
+*/
+static void init_partial (Stats_Partial_t* p) {
+	memset(p, 0, sizeof(Stats_Partial_t));
+	p->min = 0xFFFFFFFFU;
+}
+
+/*
+	PURPOSE: Profiles a band of rows into private counters, then merges
+		them into the totals
+	INPUT: arg - the Stats_Args_t
+		row_begin, row_end - rows of the band
+	RETURN: Nothing
+*/
+static void stats_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	Stats_Args_t* args = arg;
+	const Matrix_t* m = args->m;
+	Stats_Partial_t* p = malloc(sizeof(Stats_Partial_t));
+	if (!p) {
+		pthread_mutex_lock(&args->lock);
+		args->failed = true;
+		pthread_mutex_unlock(&args->lock);
+		return;
+	}
+	init_partial(p);
+
+	for (unsigned int i = row_begin; i < row_end; ++i) {
+		const unsigned int* row = &m->data[(size_t) i * m->stride];
+		unsigned int min = p->min;
+		unsigned int max = p->max;
+		unsigned long long sum = 0;
+		for (unsigned int j = 0; j < m->cols; ++j) {
+			const unsigned int v = row[j];
+			min = v < min ? v : min;
+			max = v > max ? v : max;
+			sum += v;
+			p->sum_squares += (unsigned long long) v * v;
+			++p->histogram[bucket_of(v)];
+			/* the first bits of the hash pick the register, the rest give the rank */
+			const unsigned long long h = hash_value(v);
+			const unsigned long long rest = h << STATS_HLL_BITS;
+			const unsigned char rank = rest ? __builtin_clzll(rest) + 1 : 64 - STATS_HLL_BITS + 1;
+			unsigned char* reg = &p->registers[h >> (64 - STATS_HLL_BITS)];
+			*reg = rank > *reg ? rank : *reg;
+		}
+		p->min = min;
+		p->max = max;
+		p->sum += sum;
+		p->count += m->cols;
+		if (args->values) {
+			memcpy(&args->values[(size_t) i * m->cols], row, m->cols * sizeof(unsigned int));
+		}
+	}
+
+	pthread_mutex_lock(&args->lock);
+	Stats_Partial_t* t = &args->total;
+	t->count += p->count;
+	t->sum += p->sum;
+	t->sum_squares += p->sum_squares;
+	t->min = p->min < t->min ? p->min : t->min;
+	t->max = p->max > t->max ? p->max : t->max;
+	for (unsigned int b = 0; b < STATS_BUCKETS; ++b) {
+		t->histogram[b] += p->histogram[b];
+	}
+	for (unsigned int r = 0; r < STATS_HLL_REGISTERS; ++r) {
+		t->registers[r] = p->registers[r] > t->registers[r] ? p->registers[r] : t->registers[r];
+	}
+	pthread_mutex_unlock(&args->lock);
+	free(p);
+}
+
+/*
+	PURPOSE: HyperLogLog estimate of the number of distinct values, with
+		linear counting while many registers are still empty
+	INPUT: registers - the merged registers
+	RETURN: The estimate
+*/
+static unsigned long long estimate_distinct (const unsigned char* registers) {
+	const double m = STATS_HLL_REGISTERS;
+	double inverse_sum = 0;
+	unsigned int zeros = 0;
+	for (unsigned int r = 0; r < STATS_HLL_REGISTERS; ++r) {
+		inverse_sum += ldexp(1.0, -registers[r]);
+		zeros += registers[r] == 0;
+	}
+	const double estimate = 0.7213 / (1 + 1.079 / m) * m * m / inverse_sum;
+	if (estimate <= 2.5 * m && zeros) {
+		return (unsigned long long) (m * log(m / zeros) + 0.5);
+	}
+	return (unsigned long long) (estimate + 0.5);
+}
+
+/*
+	PURPOSE: Quantile read off the histogram, interpolated inside the
+		bucket that holds it
+	INPUT: stats - results with the histogram, count, min and max set
+		q - the quantile, between 0 and 1
+	RETURN: The estimated value
+*/
+static unsigned int histogram_quantile (const Matrix_Stats_t* stats, double q) {
+	unsigned long long rank = (unsigned long long) ceil(q * stats->count);
+	rank = rank ? rank : 1;
+	unsigned long long below = 0;
+	for (unsigned int b = 0; b < STATS_BUCKETS; ++b) {
+		if (below + stats->histogram[b] < rank) {
+			below += stats->histogram[b];
+			continue;
+		}
+		unsigned int low;
+		unsigned int high;
+		bucket_range(b, &low, &high);
+		low = low < stats->min ? stats->min : low;
+		high = high > stats->max ? stats->max : high;
+		const double within = (rank - below - 0.5) / stats->histogram[b];
+		return low + (unsigned int) ((double) (high - low) * within + 0.5);
+	}
+	return stats->max;
+}
+
+/*
+	PURPOSE: qsort order of unsigned ints
+	INPUT: a, b - the values
+	RETURN: Negative, zero or positive like strcmp
+*/
+static int compare_values (const void* a, const void* b) {
+	const unsigned int x = *(const unsigned int*) a;
+	const unsigned int y = *(const unsigned int*) b;
+	return (x > y) - (x < y);
+}
@@ -0,0 +1,28 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+/* values below this are their own bucket, above it every power of two
+ * is split into this many equal buckets */
+#define STATS_SUB_BUCKETS 16
+#define STATS_BUCKETS (29 * STATS_SUB_BUCKETS)
+/* matrices up to this many elements get exact quantiles and distinct counts */
+#define STATS_EXACT_MAX (1 << 20)
+#define STATS_QUANTILES 7
+
+typedef struct {
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned int min;
+	unsigned int max;
+	double mean;
+	double stddev;
+	bool exact;				/* quantiles and distinct are exact, else estimates */
+	unsigned long long distinct;
+	unsigned int quantiles[STATS_QUANTILES];	/* p1, p5, p25, p50, p75, p95, p99 */
+	unsigned long long histogram[STATS_BUCKETS];
+}Matrix_Stats_t;
+
+bool matrix_stats (Matrix_t* m, Matrix_Stats_t* stats);
+void display_stats (const char* name, const Matrix_Stats_t* stats, FILE* out);
+
+#endif
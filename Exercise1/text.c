@@ -0,0 +1,667 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "command.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "text.h"
+#include "trace.h"
+
+/*
+ * Text output of matrices. Rows are formatted with a two digit lookup
+ * table into a per thread buffer that is reused between calls, then
+ * handed over in a few large fwrite()s, which go straight to write() on
+ * unbuffered streams. Big outputs are cut
+ * into chunks whose rows are formatted by the worker threads in parallel
+ * and written out in order.
+ *
+ * Text input goes the other way: the file is mmapped, split at newlines
+ * and each piece parsed by its own worker. With SSE2 a number's digits are
+ * found sixteen bytes at a time, and they are converted eight at a time.
+ */
+
+/* longest formatted unsigned int plus its delimiter */
+#define TEXT_MAX_FIELD 11
+/* text formatted per worker before the chunk is written out */
+#define TEXT_CHUNK_BYTES_PER_WORKER (4 << 20)
+/* text files smaller than this are parsed by one thread */
+#define IMPORT_MIN_CHUNK_BYTES (1 << 20)
+
+static const char digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+typedef struct {
+	Matrix_t* m;
+	unsigned int chunk_begin;
+	unsigned int edge_cols;
+	char delimiter;
+	bool trailing_delimiter;
+	size_t max_row_len;
+	char* buffer;
+	size_t* row_starts;
+	size_t* row_ends;
+}Text_Format_Args_t;
+
+typedef struct {
+	size_t begin;
+	size_t end;
+	unsigned int rows;
+	unsigned int first_row;
+}Text_Chunk_t;
+
+typedef struct {
+	const char* text;
+	size_t size;
+	Text_Chunk_t* chunks;
+	unsigned int num_chunks;
+	Matrix_t* m;
+	unsigned int cols;
+	bool failed;
+}Text_Import_Args_t;
+
+/* reused by every text write on this thread */
+static __thread char* text_buffer = NULL;
+static __thread size_t text_buffer_cap = 0;
+static __thread size_t* text_row_starts = NULL;
+static __thread size_t* text_row_ends = NULL;
+static __thread size_t text_rows_cap = 0;
+
+/*protected functions*/
+static char* format_uint (char* out, unsigned int value);
+static char* format_cols (char* out, const unsigned int* row, unsigned int col_begin,
+			unsigned int col_end, char delimiter);
+static void format_rows_band (void* arg, unsigned int row_begin, unsigned int row_end);
+static bool write_full (FILE* out, const char* buf, size_t len);
+static bool reserve_text_buffers (size_t bytes, size_t rows);
+static bool is_field_separator (char c);
+static unsigned long long convert_digits (const char* p, unsigned int len);
+static unsigned int parse_eight_digits (const char* p, unsigned long long* value);
+#ifdef __SSE2__
+static unsigned int parse_sixteen_digits (const char* p, unsigned long long* value);
+#endif
+static const char* parse_uint (const char* p, const char* end, unsigned int* value);
+static unsigned int count_fields (const char* line, const char* end);
+static void count_rows_band (void* arg, unsigned int chunk_begin, unsigned int chunk_end);
+static void parse_rows_band (void* arg, unsigned int chunk_begin, unsigned int chunk_end);
+
+/*
+	PURPOSE: Writes rows [row_begin, row_end) of a matrix as delimited text
+	INPUT: out - where the text goes
+		m - matrix to be written
+		row_begin, row_end - rows to write
+		edge_cols - if non zero and the matrix is wider than twice this,
+			only this many cols at each end of a row are written
+		delimiter - separator between values
+		trailing_delimiter - also put the delimiter after the last value
+	RETURN: If successful returns true
+		else false
+*/
+bool write_matrix_text (FILE* out, Matrix_t* m, unsigned int row_begin, unsigned int row_end,
+			unsigned int edge_cols, char delimiter, bool trailing_delimiter) {
+
+	if (!m || !m->data)
+	{
+		printf("No matrix and/or data!\n");
+		return false;
+	}
+	if (row_begin > row_end || row_end > m->rows)
+	{
+		printf("Rows [%u,%u) are outside of the matrix!\n", row_begin, row_end);
+		return false;
+	}
+	if (edge_cols * 2 >= m->cols)
+	{
+		edge_cols = 0;
+	}
+
+	const unsigned int shown_cols = edge_cols ? edge_cols * 2 : m->cols;
+	/* values, delimiters, the "..." gap and the newline */
+	const size_t max_row_len = (size_t) shown_cols * TEXT_MAX_FIELD + 5;
+	unsigned int chunk_rows = (size_t) TEXT_CHUNK_BYTES_PER_WORKER * parallel_workers() / max_row_len;
+	if (chunk_rows == 0) {
+		chunk_rows = 1;
+	}
+	if (chunk_rows > row_end - row_begin) {
+		chunk_rows = row_end - row_begin;
+	}
+	if (!reserve_text_buffers(chunk_rows * max_row_len, chunk_rows)) {
+		printf("Failed to allocate the text buffer!\n");
+		return false;
+	}
+
+	Text_Format_Args_t args = { m, 0, edge_cols, delimiter, trailing_delimiter, max_row_len,
+			text_buffer, text_row_starts, text_row_ends };
+	for (unsigned int chunk = row_begin; chunk < row_end; chunk += chunk_rows) {
+		const unsigned int rows = chunk + chunk_rows < row_end ? chunk_rows : row_end - chunk;
+		args.chunk_begin = chunk;
+		parallel_for_rows("text:band", m->name, rows, m->cols, 1, format_rows_band, &args);
+
+		/* a band's rows are contiguous, so only band boundaries split
+		 * the write */
+		for (unsigned int r = 0; r < rows; ++r) {
+			unsigned int last = r;
+			while (last + 1 < rows && text_row_starts[last + 1] == text_row_ends[last]) {
+				++last;
+			}
+			if (!write_full(out, &text_buffer[text_row_starts[r]], text_row_ends[last] - text_row_starts[r])) {
+				return false;
+			}
+			r = last;
+		}
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Writes a matrix to a CSV or TSV text file
+	INPUT: matrix_output_filename - file for the text to be wrote to
+		m - matrix to be wrote out
+		delimiter - ',' for CSV or '\t' for TSV
+	RETURN: If successful returns true
+		else false
+*/
+bool export_matrix (const char* matrix_output_filename, Matrix_t* m, char delimiter) {
+
+	if (!matrix_output_filename)
+	{
+		printf("No filename!\n");
+		return false;
+	}
+	if (!m || !m->data)
+	{
+		printf("No matrix and/or data!\n");
+		return false;
+	}
+
+	FILE* out = fopen(matrix_output_filename, "w");
+	if (!out) {
+		perror("FAILED TO CREATE/OPEN FILE FOR WRITING\n");
+		return false;
+	}
+	/* the chunks are already big, hand them straight to write() */
+	setvbuf(out, NULL, _IONBF, 0);
+
+	trace_begin("export", m->name, m->rows, m->cols);
+	bool written = write_matrix_text(out, m, 0, m->rows, 0, delimiter, false);
+	trace_end("export", m->name);
+
+	if (fclose(out)) {
+		return false;
+	}
+	return written;
+}
+
+/*
+	PURPOSE: Loads a CSV, TSV or whitespace separated text file into a new
+		matrix. The file is mmapped and cut at line boundaries into one
+		chunk per worker. A first parallel pass counts each chunk's rows,
+		and a second one parses every chunk straight into its rows
+	INPUT: matrix_input_filename - text file to be imported
+		name - the name of the new matrix
+		m - pointer to the new matrix, must point to NULL
+	RETURN: If successful returns true
+		else false
+*/
+bool import_matrix (const char* matrix_input_filename, const char* name, Matrix_t** m) {
+
+	if (!matrix_input_filename)
+	{
+		printf("No filename!\n");
+		return false;
+	}
+	if (!m || *m)
+	{
+		printf("Matrix must point to NULL!\n");
+		return false;
+	}
+
+	int fd = open(matrix_input_filename, O_RDONLY);
+	if (fd < 0) {
+		perror("FAILED TO OPEN FOR READING\n");
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size == 0) {
+		printf("Nothing to import in %s\n", matrix_input_filename);
+		close(fd);
+		return false;
+	}
+	const char* text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED) {
+		perror("FAILED TO MAP FILE\n");
+		return false;
+	}
+	madvise((void*) text, st.st_size, MADV_SEQUENTIAL);
+
+	/* trailing blank lines are not rows */
+	size_t size = st.st_size;
+	while (size > 0 && is_field_separator(text[size - 1])) {
+		--size;
+	}
+
+	Text_Import_Args_t args = { text, size, NULL, 0, NULL, 0, false };
+	args.num_chunks = size < IMPORT_MIN_CHUNK_BYTES ? 1 : parallel_workers();
+	args.chunks = calloc(args.num_chunks, sizeof(Text_Chunk_t));
+	bool imported = false;
+	if (!args.chunks || size == 0) {
+		printf("Nothing to import in %s\n", matrix_input_filename);
+		goto unmap;
+	}
+
+	/* cut at the first newline after each even split point */
+	for (unsigned int c = 0; c < args.num_chunks; ++c) {
+		size_t begin = size * c / args.num_chunks;
+		if (c > 0) {
+			const char* nl = memchr(&text[begin], '\n', size - begin);
+			begin = nl ? (size_t) (nl - text) + 1 : size;
+			if (begin < args.chunks[c - 1].begin) {
+				begin = args.chunks[c - 1].begin;
+			}
+		}
+		args.chunks[c].begin = begin;
+	}
+	for (unsigned int c = 0; c < args.num_chunks; ++c) {
+		args.chunks[c].end = c + 1 < args.num_chunks ? args.chunks[c + 1].begin : size;
+	}
+
+	/* the first line fixes the number of cols */
+	const char* first_nl = memchr(text, '\n', size);
+	const char* first_end = first_nl ? first_nl : text + size;
+	args.cols = count_fields(text, first_end);
+	if (args.cols == 0) {
+		printf("The first line of %s has no values!\n", matrix_input_filename);
+		goto unmap;
+	}
+
+	trace_begin("import", name, 0, args.cols);
+	parallel_for_rows("import:count", name, args.num_chunks, args.cols, 1, count_rows_band, &args);
+	unsigned int rows = 0;
+	for (unsigned int c = 0; c < args.num_chunks; ++c) {
+		args.chunks[c].first_row = rows;
+		rows += args.chunks[c].rows;
+	}
+
+	if (!create_matrix(m, name, rows, args.cols)) {
+		trace_end("import", name);
+		goto unmap;
+	}
+	args.m = *m;
+	parallel_for_rows("import:parse", name, args.num_chunks, args.cols, 1, parse_rows_band, &args);
+	trace_end("import", name);
+
+	if (args.failed) {
+		destroy_matrix(m);
+		goto unmap;
+	}
+	imported = true;
+
+unmap:
+	free(args.chunks);
+	munmap((void*) text, st.st_size);
+	return imported;
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: Formats an unsigned int two digits at a time
+	INPUT: out - where the digits go
+		value - number to be formatted
+	RETURN: One past the last digit written
+*/
+static char* format_uint (char* out, unsigned int value) {
+	char digits[10];
+	char* p = digits + sizeof(digits);
+
+	while (value >= 100) {
+		const unsigned int pair = value % 100;
+		value /= 100;
+		p -= 2;
+		memcpy(p, &digit_pairs[pair * 2], 2);
+	}
+	if (value >= 10) {
+		p -= 2;
+		memcpy(p, &digit_pairs[value * 2], 2);
+	}
+	else {
+		*--p = '0' + value;
+	}
+
+	const size_t len = digits + sizeof(digits) - p;
+	memcpy(out, p, len);
+	return out + len;
+}
+
+/*
+	PURPOSE: Formats cols [col_begin, col_end) of a row, each followed by
+		the delimiter
+	INPUT: out - where the text goes
+		row - first element of the row
+		col_begin, col_end - cols to format
+		delimiter - separator after each value
+	RETURN: One past the last character written
+*/
+static char* format_cols (char* out, const unsigned int* row, unsigned int col_begin,
+			unsigned int col_end, char delimiter) {
+	for (unsigned int j = col_begin; j < col_end; ++j) {
+		out = format_uint(out, row[j]);
+		*out++ = delimiter;
+	}
+	return out;
+}
+
+/*
+	PURPOSE: Formats a band of rows of the current chunk. The band is
+		written contiguously from the slot of its first row
+	INPUT: arg - the Text_Format_Args_t
+		row_begin, row_end - rows of the chunk to format
+	RETURN: Nothing
+*/
+static void format_rows_band (void* arg, unsigned int row_begin, unsigned int row_end) {
+	Text_Format_Args_t* t = arg;
+	const Matrix_t* m = t->m;
+	char* out = &t->buffer[row_begin * t->max_row_len];
+
+	for (unsigned int r = row_begin; r < row_end; ++r) {
+		t->row_starts[r] = out - t->buffer;
+		const unsigned int* row = &m->data[(size_t) (t->chunk_begin + r) * m->stride];
+		if (t->edge_cols) {
+			out = format_cols(out, row, 0, t->edge_cols, t->delimiter);
+			memcpy(out, "...", 3);
+			out += 3;
+			*out++ = t->delimiter;
+			out = format_cols(out, row, m->cols - t->edge_cols, m->cols, t->delimiter);
+		}
+		else {
+			out = format_cols(out, row, 0, m->cols, t->delimiter);
+		}
+		if (!t->trailing_delimiter) {
+			--out;
+		}
+		*out++ = '\n';
+		t->row_ends[r] = out - t->buffer;
+	}
+}
+
+/*
+	PURPOSE: Writes all of a buffer to a stream
+	INPUT: out - where the bytes go
+		buf - bytes to write
+		len - number of bytes
+	RETURN: If everything was written returns true
+		else false
+*/
+static bool write_full (FILE* out, const char* buf, size_t len) {
+	if (fwrite(buf, 1, len, out) != len) {
+		perror("FAILED TO WRITE MATRIX TEXT\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Grows this thread's text buffers to at least the given sizes
+	INPUT: bytes - bytes of formatted text
+		rows - rows per chunk
+	RETURN: If the buffers are big enough returns true
+		else false
+*/
+static bool reserve_text_buffers (size_t bytes, size_t rows) {
+	if (bytes > text_buffer_cap) {
+		char* grown = realloc(text_buffer, bytes);
+		if (!grown) {
+			return false;
+		}
+		text_buffer = grown;
+		text_buffer_cap = bytes;
+	}
+	if (rows > text_rows_cap) {
+		size_t* starts = realloc(text_row_starts, rows * sizeof(size_t));
+		if (starts) {
+			text_row_starts = starts;
+		}
+		size_t* ends = realloc(text_row_ends, rows * sizeof(size_t));
+		if (ends) {
+			text_row_ends = ends;
+		}
+		if (!starts || !ends) {
+			return false;
+		}
+		text_rows_cap = rows;
+	}
+	return true;
+}
+
+/*
+	PURPOSE: Checks for the characters allowed between values
+	INPUT: c - character to be checked
+	RETURN: true for ',', ';', spaces, tabs and line ends
+		else false
+*/
+static bool is_field_separator (char c) {
+	return c == ',' || c == ';' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/*
+	PURPOSE: Converts up to eight digits at once as one 64 bit word
+	INPUT: p - first digit, 8 readable bytes
+		len - number of digits, 1 to 8
+	RETURN: Their value
+*/
+static unsigned long long convert_digits (const char* p, unsigned int len) {
+	unsigned long long x;
+	memcpy(&x, p, sizeof(x));
+
+	/* right align the digits so the missing high ones read as 0 */
+	unsigned long long v = (x ^ 0x3030303030303030ULL) << (8 * (8 - len));
+	v = (v * 10) + (v >> 8);
+	v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+			+ (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+	return v;
+}
+
+/*
+	PURPOSE: Counts the digits at p and converts the first eight of them.
+		Eight bytes are checked at once as one 64 bit word
+	INPUT: p - first character of the number, 8 readable bytes
+		value - the converted leading digits
+	RETURN: Number of leading digits, up to 8
+*/
+static unsigned int parse_eight_digits (const char* p, unsigned long long* value) {
+	unsigned long long x;
+	memcpy(&x, p, sizeof(x));
+
+	/* digit bytes become 0..9, anything else has its byte's top bit set */
+	const unsigned long long d = x ^ 0x3030303030303030ULL;
+	const unsigned long long not_digit = (((d & 0x7F7F7F7F7F7F7F7FULL) + 0x7676767676767676ULL) | d)
+			& 0x8080808080808080ULL;
+	const unsigned int len = not_digit ? __builtin_ctzll(not_digit) / 8 : 8;
+	*value = len ? convert_digits(p, len) : 0;
+	return len;
+}
+
+#ifdef __SSE2__
+/*
+	PURPOSE: Counts the digits at p with one 16 byte SSE2 compare and
+		converts the first sixteen of them
+	INPUT: p - first character of the number, 16 readable bytes
+		value - the converted leading digits
+	RETURN: Number of leading digits, up to 16
+*/
+static unsigned int parse_sixteen_digits (const char* p, unsigned long long* value) {
+	static const unsigned long long powers[9] = {
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+	};
+	const __m128i x = _mm_loadu_si128((const __m128i*) p);
+	/* bytes above 0x7F compare as negative, so they are below '0' too */
+	const __m128i not_digit = _mm_or_si128(_mm_cmplt_epi8(x, _mm_set1_epi8('0')),
+			_mm_cmpgt_epi8(x, _mm_set1_epi8('9')));
+	const unsigned int len = __builtin_ctz(_mm_movemask_epi8(not_digit) | 0x10000);
+
+	if (len == 0) {
+		*value = 0;
+	}
+	else if (len <= 8) {
+		*value = convert_digits(p, len);
+	}
+	else {
+		*value = convert_digits(p, 8) * powers[len - 8] + convert_digits(p + 8, len - 8);
+	}
+	return len;
+}
+#endif
+
+/*
+	PURPOSE: Parses one unsigned int
+	INPUT: p - first character of the number
+		end - end of the text
+		value - the parsed number
+	RETURN: One past the last digit, or NULL if there is no valid number
+*/
+static const char* parse_uint (const char* p, const char* end, unsigned int* value) {
+	unsigned long long v = 0;
+	const char* start = p;
+	unsigned int len = 0;
+	unsigned int width = 0;
+
+#ifdef __SSE2__
+	if (end - p >= 16) {
+		width = 16;
+		len = parse_sixteen_digits(p, &v);
+	}
+	else
+#endif
+	if (end - p >= 8) {
+		width = 8;
+		len = parse_eight_digits(p, &v);
+	}
+	if (width > 0) {
+		p += len;
+		if (len == 0 || v > UINT_MAX) {
+			return NULL;
+		}
+		if (len < width) {
+			*value = v;
+			return p;
+		}
+	}
+	for (; p < end && (unsigned char) (*p - '0') < 10; ++p) {
+		v = v * 10 + (*p - '0');
+		if (v > UINT_MAX) {
+			return NULL;
+		}
+	}
+	if (p == start) {
+		return NULL;
+	}
+	*value = v;
+	return p;
+}
+
+/*
+	PURPOSE: Counts the values on one line
+	INPUT: line - first character of the line
+		end - the line's newline or the end of the text
+	RETURN: The number of values, 0 if the line is not all numbers
+*/
+static unsigned int count_fields (const char* line, const char* end) {
+	unsigned int fields = 0;
+	unsigned int value;
+	while (line < end) {
+		while (line < end && is_field_separator(*line)) {
+			++line;
+		}
+		if (line == end) {
+			break;
+		}
+		line = parse_uint(line, end, &value);
+		if (!line) {
+			return 0;
+		}
+		++fields;
+	}
+	return fields;
+}
+
+/*
+	PURPOSE: Counts the rows of a band of chunks
+	INPUT: arg - the Text_Import_Args_t
+		chunk_begin, chunk_end - chunks to count
+	RETURN: Nothing
+*/
+static void count_rows_band (void* arg, unsigned int chunk_begin, unsigned int chunk_end) {
+	Text_Import_Args_t* t = arg;
+	for (unsigned int c = chunk_begin; c < chunk_end; ++c) {
+		Text_Chunk_t* chunk = &t->chunks[c];
+		const char* p = &t->text[chunk->begin];
+		const char* end = &t->text[chunk->end];
+		unsigned int rows = 0;
+		while (p < end) {
+			const char* nl = memchr(p, '\n', end - p);
+			++rows;
+			p = nl ? nl + 1 : end;
+		}
+		chunk->rows = rows;
+	}
+}
+
+/*
+	PURPOSE: Parses a band of chunks into their rows of the matrix
+	INPUT: arg - the Text_Import_Args_t
+		chunk_begin, chunk_end - chunks to parse
+	RETURN: Nothing, bad lines are reported and flagged in the args
+*/
+static void parse_rows_band (void* arg, unsigned int chunk_begin, unsigned int chunk_end) {
+	Text_Import_Args_t* t = arg;
+	Matrix_t* m = t->m;
+
+	for (unsigned int c = chunk_begin; c < chunk_end && !t->failed; ++c) {
+		const char* p = &t->text[t->chunks[c].begin];
+		const char* end = &t->text[t->chunks[c].end];
+		unsigned int row = t->chunks[c].first_row;
+
+		while (p < end) {
+			const char* nl = memchr(p, '\n', end - p);
+			const char* line_end = nl ? nl : end;
+			unsigned int* out = &m->data[(size_t) row * m->stride];
+			unsigned int col = 0;
+
+			while (p < line_end) {
+				while (p < line_end && is_field_separator(*p)) {
+					++p;
+				}
+				if (p == line_end) {
+					break;
+				}
+				if (col == m->cols || !(p = parse_uint(p, line_end, &out[col]))) {
+					col = m->cols + 1;
+					break;
+				}
+				++col;
+			}
+			if (col != m->cols) {
+				printf("Line %u does not have %u unsigned int values!\n", row + 1, m->cols);
+				t->failed = true;
+				return;
+			}
+			++row;
+			p = line_end + 1;
+		}
+	}
+}
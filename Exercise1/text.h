@@ -0,0 +1,14 @@
+#ifndef _TEXT_H_
+#define _TEXT_H_
+
+/* display previews matrices with more rows or cols than this */
+#define TEXT_PREVIEW_LIMIT 64
+/* rows and cols shown at each end of a preview */
+#define TEXT_PREVIEW_EDGE 8
+
+bool write_matrix_text (FILE* out, Matrix_t* m, unsigned int row_begin, unsigned int row_end,
+			unsigned int edge_cols, char delimiter, bool trailing_delimiter);
+bool export_matrix (const char* matrix_output_filename, Matrix_t* m, char delimiter);
+bool import_matrix (const char* matrix_input_filename, const char* name, Matrix_t** m);
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "command.h"
+#include "trace.h"
+
+/*
+ * Chrome trace-event output (load the file in chrome://tracing or
+ * ui.perfetto.dev). Every traced region emits a "B" event when it starts
+ * and an "E" event when it ends, stamped with the pid and the kernel
+ * thread id so spans from worker threads land on their own tracks.
+ */
+
+#define TRACE_CMD_LEN 256
+
+static FILE* trace_file = NULL;
+static bool trace_first_event = true;
+static struct timespec trace_start;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*protected functions*/
+static double trace_timestamp (void);
+static void trace_write_string (const char* str);
+static void trace_write_event_head (const char* name, const char* cat, char phase);
+
+/*
+	PURPOSE: Opens the trace file and starts the trace event array
+	INPUT: trace_output_filename - file the JSON trace is written to
+	RETURN: If the file was opened returns true
+		else false
+*/
+bool trace_open (const char* trace_output_filename) {
+
+	if (!trace_output_filename)
+	{
+		printf("No trace filename!\n");
+		return false;
+	}
+	if (trace_file)
+	{
+		printf("Trace is already open!\n");
+		return false;
+	}
+
+	trace_file = fopen(trace_output_filename, "w");
+	if (!trace_file) {
+		perror("FAILED TO OPEN TRACE FILE\n");
+		return false;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &trace_start);
+	trace_first_event = true;
+	fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	/* name the process track so the timeline reads "matlab" */
+	pthread_mutex_lock(&trace_lock);
+	trace_write_event_head("process_name", "__metadata", 'M');
+	fprintf(trace_file, ",\"args\":{\"name\":\"matlab\"}}");
+	pthread_mutex_unlock(&trace_lock);
+	return true;
+}
+
+/*
+	PURPOSE: Terminates the trace event array and closes the trace file
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+void trace_close (void) {
+
+	if (!trace_file)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	fprintf(trace_file, "\n]}\n");
+	fclose(trace_file);
+	trace_file = NULL;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+	PURPOSE: Turns tracing off in a forked child. The inherited trace file
+		and its buffered events belong to the parent, so the child drops
+		them without writing anything
+	INPUT: Nothing
+	RETURN: Nothing
+*/
+void trace_detach (void) {
+	trace_file = NULL;
+}
+
+/*
+	PURPOSE: Checks if tracing is turned on
+	INPUT: Nothing
+	RETURN: If a trace file is open returns true
+		else false
+*/
+bool trace_enabled (void) {
+	return trace_file != NULL;
+}
+
+/*
+	PURPOSE: Starts the span of a user command
+	INPUT: cmd - the parsed command about to be run
+	RETURN: Nothing
+*/
+void trace_command_begin (Commands_t* cmd) {
+
+	if (!trace_file || !cmd || cmd->num_cmds == 0)
+	{
+		return;
+	}
+
+	/* rebuild the command line so the span shows its operands */
+	char line[TRACE_CMD_LEN] = {0};
+	unsigned int offset = 0;
+	for (unsigned int i = 0; i < cmd->num_cmds && offset < TRACE_CMD_LEN - 1; ++i) {
+		offset += snprintf(&line[offset], TRACE_CMD_LEN - offset, "%s%s",
+				i ? " " : "", cmd->cmds[i]);
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	trace_write_event_head(cmd->cmds[0], "command", 'B');
+	fprintf(trace_file, ",\"args\":{\"command\":");
+	trace_write_string(line);
+	fprintf(trace_file, "}}");
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+	PURPOSE: Ends the span of a user command
+	INPUT: cmd - the parsed command that was run
+	RETURN: Nothing
+*/
+void trace_command_end (Commands_t* cmd) {
+
+	if (!trace_file || !cmd || cmd->num_cmds == 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	trace_write_event_head(cmd->cmds[0], "command", 'E');
+	fprintf(trace_file, "}");
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+	PURPOSE: Starts the span of a matrix operation on the calling thread
+	INPUT: op - name of the operation
+		matrix_name - matrix the operation works on
+		rows, cols - dimensions the operation covers
+	RETURN: Nothing
+*/
+void trace_begin (const char* op, const char* matrix_name, unsigned int rows, unsigned int cols) {
+
+	if (!trace_file || !op)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	trace_write_event_head(op, "matrix", 'B');
+	fprintf(trace_file, ",\"args\":{\"matrix\":");
+	trace_write_string(matrix_name ? matrix_name : "");
+	fprintf(trace_file, ",\"rows\":%u,\"cols\":%u,\"bytes\":%llu}}", rows, cols,
+			(unsigned long long) rows * cols * sizeof(unsigned int));
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+	PURPOSE: Ends the span of a matrix operation on the calling thread
+	INPUT: op - name of the operation
+		matrix_name - matrix the operation worked on
+	RETURN: Nothing
+*/
+void trace_end (const char* op, const char* matrix_name) {
+
+	if (!trace_file || !op)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	trace_write_event_head(op, "matrix", 'E');
+	fprintf(trace_file, "}");
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/*Protected Functions in C*/
+
+/*
+	PURPOSE: Microseconds since the trace was opened
+	INPUT: Nothing
+	RETURN: The timestamp in microseconds
+*/
+static double trace_timestamp (void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - trace_start.tv_sec) * 1e6 + (now.tv_nsec - trace_start.tv_nsec) / 1e3;
+}
+
+/*
+	PURPOSE: Writes a quoted and escaped JSON string, caller holds trace_lock
+	INPUT: str - string to be written
+	RETURN: Nothing
+*/
+static void trace_write_string (const char* str) {
+	fputc('"', trace_file);
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\') {
+			fprintf(trace_file, "\\%c", *str);
+		}
+		else if ((unsigned char) *str < 0x20) {
+			fprintf(trace_file, "\\u%04x", (unsigned char) *str);
+		}
+		else {
+			fputc(*str, trace_file);
+		}
+	}
+	fputc('"', trace_file);
+}
+
+/*
+	PURPOSE: Writes the fields every event shares, leaving the object open.
+		Caller holds trace_lock
+	INPUT: name - event name
+		cat - event category
+		phase - trace event phase ('B', 'E', 'M')
+	RETURN: Nothing
+*/
+static void trace_write_event_head (const char* name, const char* cat, char phase) {
+	fprintf(trace_file, "%s{\"name\":", trace_first_event ? "" : ",\n");
+	trace_first_event = false;
+	trace_write_string(name);
+	fprintf(trace_file, ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%ld",
+			cat, phase, trace_timestamp(), (int) getpid(), (long) syscall(SYS_gettid));
+}
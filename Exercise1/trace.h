@@ -0,0 +1,13 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+bool trace_open (const char* trace_output_filename);
+void trace_close (void);
+void trace_detach (void);
+bool trace_enabled (void);
+void trace_command_begin (Commands_t* cmd);
+void trace_command_end (Commands_t* cmd);
+void trace_begin (const char* op, const char* matrix_name, unsigned int rows, unsigned int cols);
+void trace_end (const char* op, const char* matrix_name);
+
+#endif